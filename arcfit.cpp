@@ -0,0 +1,178 @@
+#include "arcfit.h"
+#include "compact.h"
+#include <cmath>
+using namespace std;
+
+#define DEG (180 / M_PI)
+
+void arcfit_init (arcfit_t *a) {
+	a->run.clear ();
+	a->pt.clear ();
+	a->fitted = false;
+	a->anchored = false;
+	for (int i=0; i < 3; i++) a->off[i] = 0;
+	a->feed = 0;
+	a->arcs = 0;
+	a->replaced = 0;
+	a->out.clear ();
+}
+
+static bool off_zero (arcfit_t *a) {
+	return fabs (a->off[0]) < 1e-6 && fabs (a->off[1]) < 1e-6 && fabs (a->off[2]) < 1e-6;
+}
+
+// put the machine back where the G-code has it, with a small MOVR
+static void take_out_off (arcfit_t *a, int line) {
+	if (off_zero (a) || a->feed <= 0) return;
+	ircmd_t fix = {MOVR, line, {{0, 0, 0, a->feed}}};
+	for (int i=0; i < 3; i++) {
+		fix.a.f[i] = hundredths (-a->off[i]);
+		a->off[i] += fix.a.f[i];
+	}
+	if (fix.a.f[0] != 0 || fix.a.f[1] != 0 || fix.a.f[2] != 0) a->out.push_back (fix);
+}
+
+// pass a command on, taking out whatever the arcs so far have left the machine off by
+static void send (arcfit_t *a, const ircmd_t *c) {
+	ircmd_t o = *c;
+	if (c->op == MOVR) {
+		if (!off_zero (a)) {
+			for (int i=0; i < 3; i++) {
+				o.a.f[i] = hundredths (c->a.f[i] - a->off[i]);
+				a->off[i] += (double) o.a.f[i] - c->a.f[i];
+			}
+		}
+	} else if (c->op == MOVA) {
+		for (int i=0; i < 3; i++) a->off[i] = 0;
+	} else if (c->op == HOME) {
+		for (int i=0; i < 3; i++) {
+			if (c->a.i[0] & (1 << i)) a->off[i] = 0;
+		}
+	} else if (c->op != MARC && c->op != MHLX) {
+		take_out_off (a, c->line);
+	}
+	a->out.push_back (o);
+	if (c->op == MOVA || c->op == MOVR || c->op == MARC) a->feed = c->a.f[3];
+	a->anchored = c->op == MOVA;	// anything else may move us, or move the origin
+	a->anchor = o;
+}
+
+/* Is there an arc from where the machine is (the run's start, plus 'off') through every
+ * point of the run, and close to the middle of every move in it? If so it goes in a->fit. */
+static bool try_fit (arcfit_t *a) {
+	int n = a->run.size ();
+	const double *p = a->pt.data ();	// vertex i (1..n) is p[3i-3..]; vertex 0, the start, is 0
+	float feed = a->run[0].a.f[3];
+
+	// the circle through the start, the middle point and the end
+	double bx = p[3*((n+1)/2)-3], by = p[3*((n+1)/2)-2], cx = p[3*n-3], cy = p[3*n-2];
+	double d = 2 * (bx * cy - by * cx);
+	if (fabs (d) < 1e-12) return false;
+	double b2 = bx*bx + by*by, c2 = cx*cx + cy*cy;
+	double ux = (cy * b2 - by * c2) / d, uy = (bx * c2 - cx * b2) / d;
+	if (hypot (ux, uy) > ARCFIT_MAX_RADIUS) return false;
+	double sweep = 0;
+	for (int i=1; i <= n; i++) {
+		double x0 = (i > 1 ? p[3*i-6] : 0) - ux, y0 = (i > 1 ? p[3*i-5] : 0) - uy;
+		double x1 = p[3*i-3] - ux, y1 = p[3*i-2] - uy;
+		sweep += atan2 (x0 * y1 - y0 * x1, x0 * x1 + y0 * y1);
+	}
+
+	// the operands, as they'll reach the firmware, and the arc they really describe
+	const double *s = a->off;
+	double rq = hundredths (hypot (s[0] - ux, s[1] - uy));
+	double tq = hundredths (atan2 (s[1] - uy, s[0] - ux) * DEG), dq = hundredths (sweep * DEG);
+	if (rq <= 0 || dq == 0) return false;
+	bool helix = false;
+	for (int i=1; i <= n && !helix; i++) helix = p[3*i-1] != 0;
+	if (helix ? feed != a->feed : fabs (dq) > 360) return false;	// a helix goes at the feedrate there already is
+	double lead = helix ? hundredths ((p[3*n-1] - s[2]) * 360 / dq) : 0;
+	double qx = s[0] - rq * cos (tq / DEG), qy = s[1] - rq * sin (tq / DEG);
+
+	double along = 0, px = s[0] - qx, py = s[1] - qy;
+	for (int i=1; i <= n; i++) {
+		double x = p[3*i-3], y = p[3*i-2], z = p[3*i-1];
+		double mx = ((i > 1 ? p[3*i-6] : 0) + x) / 2, my = ((i > 1 ? p[3*i-5] : 0) + y) / 2;
+		if (fabs (hypot (x - qx, y - qy) - rq) > ARCFIT_TOLERANCE) return false;
+		if (fabs (hypot (mx - qx, my - qy) - rq) > ARCFIT_TOLERANCE) return false;
+		double vx = x - qx, vy = y - qy;
+		double step = atan2 (px * vy - py * vx, px * vx + py * vy);
+		if (step * dq < 0 || fabs (step) > M_PI / 2) return false;	// it has to keep going the same way round
+		along += step;
+		px = vx;
+		py = vy;
+		if (fabs (s[2] + lead * along * DEG / 360 - z) > ARCFIT_TOLERANCE) return false;
+	}
+	double ex = qx + rq * cos ((tq + dq) / DEG), ey = qy + rq * sin ((tq + dq) / DEG), ez = s[2] + lead * dq / 360;
+	double off[3] = {ex - p[3*n-3], ey - p[3*n-2], ez - p[3*n-1]};
+	if (sqrt (off[0]*off[0] + off[1]*off[1] + off[2]*off[2]) > ARCFIT_TOLERANCE) return false;
+
+	ircmd_t arc = {(uchar) (helix ? MHLX : MARC), a->run[n-1].line, {{(float) rq, (float) tq, (float) dq, helix ? (float) lead : feed}}};
+	a->fit = arc;
+	for (int i=0; i < 3; i++) a->fit_off[i] = off[i];
+	a->fitted = true;
+	return true;
+}
+
+static void clear_run (arcfit_t *a) {
+	a->run.clear ();
+	a->pt.clear ();
+	a->fitted = false;
+}
+
+/* The run's over (c, if there is one, didn't fit into it). Either the arc goes out, or the
+ * first move does and the rest get another go. */
+static void end_run (arcfit_t *a, const ircmd_t *c) {
+	if (a->fitted && a->run.size () >= ARCFIT_MIN_MOVES) {
+		a->out.push_back (a->fit);
+		a->arcs++;
+		a->replaced += a->run.size ();
+		for (int i=0; i < 3; i++) a->off[i] = a->fit_off[i];
+		a->anchored = a->run[0].op == MOVA;	// a MOVA run carries on from its last point, as written
+		a->anchor = a->run.back ();
+		clear_run (a);
+		if (c != NULL) arcfit_push (a, c);
+		return;
+	}
+	vector<ircmd_t> redo (a->run.begin () + 1, a->run.end ());
+	send (a, &a->run[0]);
+	clear_run (a);
+	for (size_t i=0; i < redo.size(); i++) arcfit_push (a, &redo[i]);
+	if (c != NULL) arcfit_push (a, c);
+}
+
+void arcfit_push (arcfit_t *a, const ircmd_t *c) {
+	if (!ARCFIT_ARCS || ARC_LINEARIZE) {
+		a->out.push_back (*c);
+		return;
+	}
+	if (!a->run.empty ()) {
+		const ircmd_t *first = &a->run[0];
+		size_t n = a->run.size ();
+		if (c->op == first->op && c->a.f[3] == first->a.f[3] && n < ARCFIT_MAX_RUN) {
+			for (int i=0; i < 3; i++) {
+				a->pt.push_back (c->op == MOVR ? a->pt[3*n-3+i] + c->a.f[i] : (double) c->a.f[i] - a->anchor.a.f[i]);
+			}
+			a->run.push_back (*c);
+			if (n + 1 < 3 || try_fit (a)) return;
+			a->run.pop_back ();		// doesn't fit: take it back out
+			a->pt.resize (3 * n);
+		}
+		end_run (a, c);
+		return;
+	}
+	if ((c->op == MOVR || (c->op == MOVA && a->anchored)) && c->a.f[3] > 0) {
+		a->run.push_back (*c);
+		for (int i=0; i < 3; i++) {
+			a->pt.push_back (c->op == MOVR ? c->a.f[i] : (double) c->a.f[i] - a->anchor.a.f[i]);
+		}
+		a->fitted = false;
+		return;
+	}
+	send (a, c);
+}
+
+void arcfit_finish (arcfit_t *a) {
+	if (!a->run.empty ()) end_run (a, NULL);
+	if (!a->out.empty ()) take_out_off (a, a->out.back ().line);
+}
@@ -0,0 +1,39 @@
+/* arcfit.h - finds runs of short moves that lie on a circle (or a helix) and sends them as one
+ * MARC (or MHLX) instead. CAM output turns every fillet and bore into hundreds of little
+ * straight moves; the firmware can do the arc itself from one frame. */
+#ifndef ARCFIT_H
+#define ARCFIT_H
+
+#include "command.h"
+#include <vector>
+
+/* Like the simplifier, this works on runs: moves of one kind (all MOVA or all MOVR) at one
+ * feedrate. A run grows for as long as a single arc from its start fits every point and the
+ * middle of every move in it to within ARCFIT_TOLERANCE. When that stops, the arc goes out
+ * if it stood in for at least ARCFIT_MIN_MOVES moves, and otherwise the first move goes out
+ * as it is and the rest are tried again from there.
+ *
+ * The arc is checked with its operands rounded to hundredths, as the v3 frames carry them, so
+ * where it ends up is never quite where the G-code had it. That offset is kept in 'off' and
+ * taken out of the next relative move, so it never adds up; a MOVA or a HOME clears it, and
+ * before anything else that cares where the machine is, a small MOVR takes it out. */
+typedef struct {
+	std::vector<ircmd_t> run;
+	std::vector<double> pt;		// the point each move in the run ends at, x y z, relative to its start
+	ircmd_t fit;			// the arc for the run so far, if 'fitted'
+	double fit_off[3];		// and where that leaves the machine, relative to the run's last point
+	bool fitted;
+	ircmd_t anchor;			// the last MOVA that went out (where a MOVA run starts from)
+	bool anchored;
+	double off[3];			// where the machine will be, less where the G-code has it
+	float feed;				// the last feedrate sent (the one a MHLX goes at)
+	unsigned long arcs;		// arcs made so far
+	unsigned long replaced;	// and the moves they stood in for
+	std::vector<ircmd_t> out;	// what's ready to go on (the caller empties it)
+} arcfit_t;
+
+void arcfit_init (arcfit_t *);
+void arcfit_push (arcfit_t *, const ircmd_t *);
+void arcfit_finish (arcfit_t *);
+
+#endif
@@ -0,0 +1,240 @@
+/* bench.cpp - drives iocore against the firmware emulator and reports throughput.
+ * Run it with 'make bench-protocol', or directly; see usage() for the knobs. */
+#include "iocore.h"
+#include "emulator.h"
+#include "profile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+Component *focus = NULL;	// gui.cpp wants this; there's no GUI here
+static bool verbose = false;
+static bool profile = false;	// add up the job profile as it runs, and write it out at the end
+static vector<long> latency;	// ACK latency of every command, in microseconds
+static pthread_mutex_t qpos_mut = PTHREAD_MUTEX_INITIALIZER;
+static float qpos[3];			// the last position the router reported
+static bool qpos_seen = false;
+
+static void record_ack (unsigned short seq, long us) {
+	latency.push_back (us);
+}
+
+static double seconds (struct timeval tv) {
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double now () {
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return seconds (tv);
+}
+
+// wait up to 'timeout' seconds for iocore to have nothing to do
+static bool wait_idle (double timeout) {
+	double end = now () + timeout;
+	while (!iocore_idle ()) {
+		if (profile) prof_take ();
+		if (now () > end) return false;
+		usleep (1000);
+	}
+	return true;
+}
+
+// catches the answer to the qpos sent at the end (on the logger thread)
+static void qpos_sink (int level, int cat, long time_us, const char *line) {
+	float x, y, z;
+	if (sscanf (line, "X: %f Y: %f Z: %f", &x, &y, &z) != 3) return;
+	pthread_mutex_lock (&qpos_mut);
+	qpos[0] = x;
+	qpos[1] = y;
+	qpos[2] = z;
+	qpos_seen = true;
+	pthread_mutex_unlock (&qpos_mut);
+}
+
+/* Ask the router where it is, and check that against where the host thinks it sent it. The
+ * answer is in 0.01 mm, 16 bits an axis, and the host's own position is exact, so they may be a
+ * step apart; any more and some moves went missing or were decoded wrong. */
+static bool check_position () {
+	iocore_run_manual (cmd_init (QPOS, 0));
+	for (int i=0; i < 2000; i++) {	// the answer comes once it's been through the router's buffer
+		log_flush ();
+		pthread_mutex_lock (&qpos_mut);
+		bool seen = qpos_seen;
+		pthread_mutex_unlock (&qpos_mut);
+		if (seen) break;
+		usleep (1000);
+	}
+	postrack_t m;
+	iocore_machine (&m);
+	pthread_mutex_lock (&qpos_mut);
+	bool ok = qpos_seen;
+	for (int i=0; i < 3; i++) {
+		int want = (int) lrint (m.w[i] * 100) & 0xffff, got = (int) lrint (qpos[i] * 100);
+		int d = abs (want - got);
+		if (min (d, 0x10000 - d) > 1) ok = false;
+	}
+	printf ("position: host %.2f %.2f %.2f, router %.2f %.2f %.2f: %s\n", m.w[0], m.w[1], m.w[2],
+			qpos[0], qpos[1], qpos[2], !qpos_seen ? "NO ANSWER" : ok ? "ok" : "MISMATCH");
+	pthread_mutex_unlock (&qpos_mut);
+	return ok;
+}
+
+static void usage () {
+	fprintf (stderr, "usage: bench [-n commands] [-b baud] [-B firmware_max_baud] [-d buffer_depth]\n"
+					 "             [-x move_exec_us] [-2 (no v3 frames)] [-f gcode_file] [-p (write a profile)] [-v]\n"
+					 "             [-m (mixed absolute and relative moves)] [-e fraction_of_frames_garbled]\n"
+					 "             [-g garble_above_baud] [-a abort_after_commands]\n");
+	exit (1);
+}
+
+int main (int argc, char **argv) {
+	setvbuf (stdout, NULL, _IOLBF, 0);
+	int n = 1000;
+	const char *file = NULL;
+	bool build_cache = false;
+	bool mixed = false;
+	emu_config_t cfg;
+	emu_defaults (&cfg);
+
+	int opt;
+	while ((opt = getopt (argc, argv, "n:b:B:d:x:2f:pvme:g:a:")) != -1) {
+		switch (opt) {
+			case 'n':	n = atoi (optarg);	break;
+			case 'b':	cfg.baud = atoi (optarg);	break;
+			case 'B':	cfg.max_baud = atoi (optarg);	break;
+			case 'd':	cfg.depth = atoi (optarg);	break;
+			case 'x':	cfg.exec_us[MOVA] = cfg.exec_us[MOVR] = atoi (optarg);	break;
+			case '2':	cfg.v3 = false;	break;
+			case 'f':	file = optarg;	break;
+			case 'p':	profile = true;	break;
+			case 'v':	verbose = true;	break;
+			case 'm':	mixed = true;	break;
+			case 'e':	cfg.corrupt = atof (optarg);	break;
+			case 'g':	cfg.garble_above = atoi (optarg);	break;
+			case 'a':	cfg.abort_at = atoi (optarg);	break;
+			default:	usage ();
+		}
+	}
+
+	// the emulator runs in its own process so its CPU time doesn't count against the host's
+	char port[64];
+	int master = emu_open (port, sizeof(port));
+	if (master < 0) return 1;
+	pid_t emu = fork ();
+	if (emu == 0) {
+		emu_run (master, &cfg);
+		return 0;
+	}
+	close (master);
+
+	// iocore logs as it would in the host; it only gets printed if asked for
+	if (verbose) log_add_sink (log_stdout_sink, LOGC_ALL, LOG_MIN_LEVEL);
+	log_add_sink (qpos_sink, 1u << LOGC_RESP, LOG_MIN_LEVEL);
+	log_init ();
+	latency.reserve (n + 64);
+	iocore_ack_hook = record_ack;
+	iocore_set_port (port);
+	iocore_init ();
+	iocore_connect ();
+	if (!wait_idle (10)) {
+		fprintf (stderr, "bench: couldn't connect to the emulator on %s\n", port);
+		kill (emu, SIGTERM);
+		return 1;
+	}
+
+	if (file != NULL) {	// load a real job the way the host does: from the cache, or streamed in
+		double l0 = now ();
+		rjob_t *rj = rjob_open (file);
+		if (rj != NULL) {
+			printf ("%lu commands from the job cache in %.1f ms\n", (unsigned long) rj->count, (now () - l0) * 1e3);
+			iocore_load (job_new_cached (rj));
+		} else {
+			gstream_t *gs = gstream_open (file);
+			if (gs == NULL) {
+				fprintf (stderr, "bench: couldn't open %s\n", file);
+				kill (emu, SIGTERM);
+				return 1;
+			}
+			gstream_start (gs);
+			iocore_load (job_new_stream (gs));
+			build_cache = true;
+		}
+	} else {	// a dense toolpath: lots of short relative moves
+		jobir_t job;
+		ir_clear (&job);
+		for (int i=0; i < n; i++) {
+			ircmd_t c = {MOVR, i + 1, {{(i & 1) ? 0.1f : -0.1f, 0.05f, 0, 20}}};
+			if (mixed) {	// with steps that don't come out even in 0.01 mm, and now and then an absolute move
+				c.a.f[0] = (i & 1) ? 0.1234f : -0.0987f;
+				c.a.f[1] = 0.0567f;
+				if (i % 16 == 0) {
+					ircmd_t a = {MOVA, i + 1, {{10 + (i % 7) * 1.234f, 20 + (i % 5) * 2.345f, (i % 3) * 0.5f, 20}}};
+					c = a;
+				}
+			}
+			ir_push (&job, &c);
+		}
+		iocore_load (job_new (&job));
+	}
+	wait_idle (10);
+	latency.clear ();
+
+	struct rusage ru0, ru1;
+	getrusage (RUSAGE_SELF, &ru0);
+	double t0 = now ();
+	iocore_run_auto ();
+	bool done = wait_idle (3600);
+	double t1 = now ();
+	getrusage (RUSAGE_SELF, &ru1);
+	if (done && checkpoint >= 0) {	// it was aborted: once the router's cleared, make sure it still goes where it's told
+		printf ("aborted at command %d\n", (int) checkpoint);
+		vector<command_t> after;
+		after.push_back (cmd_init4f (MOVA, 0, 12.34f, 5.67f, 1, 20));
+		for (int i=0; i < 8; i++) after.push_back (cmd_init4f (MOVR, 0, 0.1234f, -0.0567f, 0, 20));
+		after.push_back (cmd_init4f (MOVA, 0, 15, 6, 0.5f, 20));
+		iocore_run_manualv (after);
+		done = wait_idle (60);
+	}
+	bool placed = done && check_position ();
+	kill (emu, SIGTERM);
+	waitpid (emu, NULL, 0);
+	if (!done) {
+		fprintf (stderr, "bench: job didn't finish\n");
+		return 1;
+	}
+
+	if (build_cache) {	// so the next run can time loading from it
+		double b0 = now ();
+		if (rjob_build (file)) printf ("job cache built in %.1f ms\n", (now () - b0) * 1e3);
+	}
+
+	if (profile) {
+		prof_take ();
+		if (prof_write (file != NULL ? file : "bench", true)) printf ("profile written to %s.profile.csv and .json\n", file != NULL ? file : "bench");
+	}
+	log_flush ();
+	if (file != NULL) n = progress;
+	double wall = t1 - t0;
+	double cpu = seconds (ru1.ru_utime) - seconds (ru0.ru_utime) + seconds (ru1.ru_stime) - seconds (ru0.ru_stime);
+	sort (latency.begin (), latency.end ());
+	int nl = latency.size ();
+	printf ("%d commands in %.3f s: %.1f commands/sec\n", n, wall, n / wall);
+	printf ("wire: %.1f bytes/command, %.1f bytes/write, %lu retransmits\n",
+			iostats.bytes_out / (double) iostats.sent, iostats.bytes_out / (double) max (1ul, iostats.writes), iostats.retransmits);
+	printf ("window: mean depth %.1f, full for %.0f%% of ACKs\n",
+			iostats.depth_sum / (double) max (1ul, iostats.acks), 100.0 * iostats.full_acks / max (1ul, iostats.acks));
+	if (nl > 0) {
+		printf ("ACK latency (us): p50 %ld  p90 %ld  p99 %ld  max %ld\n",
+				latency[nl/2], latency[nl*9/10], latency[nl*99/100], latency[nl-1]);
+	}
+	printf ("host CPU: %.3f s (%.1f us/command)\n", cpu, cpu * 1e6 / n);
+	return placed ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/* check.cpp - checks on the job pipeline that don't need a router. Run it with 'make check';
+ * it prints what it finds and exits non-zero if anything's wrong. */
+#include "planner.h"
+#include "travel.h"
+#include "loader.h"
+#include "rjob.h"
+#include "gui.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+using namespace std;
+
+Component *focus = NULL;	// gui.cpp wants this; there's no GUI here
+
+static int failures = 0;
+
+static void expect (bool ok, const char *what) {
+	printf ("%s: %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok) failures++;
+}
+
+// plan cmds from standing, planner on; returns the time it takes, and the F in effect for each MHLX in f
+static double plan (const ircmd_t *cmds, int n, vector<float> *f, vector<ircmd_t> *out = NULL) {
+	planner_t p;
+	plan_init (&p);
+	p.on = true;		// whatever PLAN_MOTION says
+	for (int i=0; i < n; i++) plan_push (&p, &cmds[i]);
+	plan_finish (&p);
+	float last = 0;
+	for (size_t i=0; i < p.out.size (); i++) {
+		const ircmd_t *c = &p.out[i];
+		if (c->op == MOVA || c->op == MOVR || c->op == MARC) last = c->a.f[3];
+		if (c->op == MHLX) f->push_back (last);
+	}
+	if (out != NULL) *out = p.out;
+	return p.t_plan;
+}
+
+/* The firmware can't change speed along a helix (it has no feedrate of its own), and a movr
+ * that goes nowhere changes the feedrate in one jump. So a helix straight after one of those,
+ * from standing, goes at no more than the machine can jump to from standing; one that follows
+ * a move that has room to speed up goes at its own limit, reached on that move. */
+static void helix_from_rest () {
+	float jump = fminf (PLAN_JERK[0], fminf (PLAN_JERK[1], PLAN_JERK[2]));
+	vector<float> f;
+	vector<ircmd_t> out;
+	ircmd_t alone[] = {
+		{MOVR, 1, {{0, 0, 0, 10}}},
+		{MHLX, 2, {{5, 0, 360, -1}}},
+	};
+	double t = plan (alone, 2, &f, &out);
+	double len = hypot (2 * M_PI * 5, 1);
+	expect (f.size () == 1 && fabsf (f[0] - fminf (10, jump)) < 0.01f, "helix from rest: goes at what it can jump to from standing");
+	expect (!out.empty () && out[0].op == MOVR && out[0].a.f[3] <= jump, "helix from rest: the feedrate-only movr jumps no further than that");
+	expect (isfinite (t) && fabs (t - len / f[0]) < 0.01, "helix from rest: time to run it, at one speed");
+
+	// ten turns after a straight run in along the tangent, and carrying on out the same way
+	f.clear ();
+	ircmd_t turns[] = {
+		{MOVR, 1, {{20, 0, 0, 10}}},
+		{MHLX, 2, {{5, -90, 3600, -0.1f}}},
+		{MOVR, 3, {{50, 0, 0, 10}}},
+	};
+	plan (turns, 3, &f);
+	expect (f.size () == 1 && fabsf (f[0] - 10) < 0.01f, "helix after a run in: goes at the G-code's feedrate, reached on the way in");
+}
+
+/* Two passes of a step-down over the same spot, written Z-1 then Z-2, with a cut far off.
+ * Going Z-2 first would be shorter, since the passes go opposite ways, but it'd plunge into
+ * stock the first pass hasn't taken off yet. */
+static void step_down_in_order () {
+	ircmd_t job[] = {
+		{HOME, 1, {{0}}},
+		{MOVA, 2, {{0, 0, 5, 50}}},
+		{MOVA, 3, {{30, 10, 5, 50}}},
+		{MOVA, 4, {{30, 10, -1, 5}}},
+		{MOVA, 5, {{10, 10, -1, 10}}},
+		{MOVA, 6, {{10, 10, 5, 5}}},
+		{MOVA, 7, {{200, 200, 5, 50}}},
+		{MOVA, 8, {{200, 200, -1, 5}}},
+		{MOVR, 9, {{5, 0, 0, 10}}},
+		{MOVA, 10, {{205, 200, 5, 5}}},
+		{MOVA, 11, {{10, 10, 5, 50}}},
+		{MOVA, 12, {{10, 10, -2, 5}}},
+		{MOVA, 13, {{30, 10, -2, 10}}},
+		{MOVA, 14, {{30, 10, 5, 5}}},
+		{MOVA, 15, {{0, 0, 5, 50}}},
+	};
+	job[0].a.i[0] = 7;
+	travel_t t;
+	travel_init (&t);
+	for (size_t i=0; i < sizeof(job) / sizeof(job[0]); i++) travel_push (&t, &job[i]);
+	travel_finish (&t);
+	int first = -1, second = -1;
+	for (size_t i=0; i < t.out.size (); i++) {
+		if (t.out[i].line == 4 && first < 0) first = i;
+		if (t.out[i].line == 13 && second < 0) second = i;
+	}
+	expect (first >= 0 && second > first, "travel: a step-down's passes stay in order");
+}
+
+/* The streaming loader and the job cache both send a job through the pipeline, and the I/O
+ * thread goes between the two (the ETA, the profile and the resume checkpoint are all by
+ * position in the job), so they have to come out with the same commands in the same order.
+ * The job here is a couple of thousand cuts scattered over the table, for the travel pass to
+ * reorder, and both are made at once so they're fighting over the work pool. */
+static void stream_matches_cache () {
+	char dir[] = "/tmp/check-XXXXXX";
+	if (mkdtemp (dir) == NULL) {
+		expect (false, "stream and cache: making a directory to work in");
+		return;
+	}
+	string path = string (dir) + "/scattered.gc";
+	FILE *f = fopen (path.c_str (), "w");
+	fprintf (f, "home xyz\nspne\n");
+	unsigned int seed = 1;
+	for (int i=0; i < 2000; i++) {
+		seed = seed * 1103515245u + 12345u;
+		float x = (seed >> 8) % 50000 / 100.0f;
+		seed = seed * 1103515245u + 12345u;
+		float y = (seed >> 8) % 35000 / 100.0f;
+		fprintf (f, "mova %.2f %.2f 5 50\nmova %.2f %.2f -1 5\nmovr 2 1 0 10\nmovr 0 -2 0 10\nmovr 0 0 6 5\n", x, y, x, y);
+	}
+	fprintf (f, "spnd\n");
+	fclose (f);
+
+	rjob_build_async (path.c_str ());
+	gstream_t *gs = gstream_open (path.c_str ());
+	vector<ircmd_t> streamed;
+	if (gs != NULL) {
+		gstream_start (gs);
+		ircmd_t c;
+		while (!gstream_finished (gs)) {
+			if (gstream_pop (gs, &c)) {
+				streamed.push_back (c);
+			} else {
+				usleep (1000);
+			}
+		}
+		gstream_close (gs);
+	}
+	while (rjob_building ()) usleep (1000);
+	rjob_t *rj = rjob_open (path.c_str ());
+
+	bool same = rj != NULL && rj->count == streamed.size () && rj->count > 2000 * 5;
+	for (size_t i=0; same && i < rj->count; i++) {
+		same = streamed[i].op == rj->cmd[i].op && streamed[i].line == rj->cmd[i].line && memcmp (&streamed[i].a, &rj->cmd[i].a, sizeof(rj->cmd[i].a)) == 0;
+	}
+	expect (same, "stream and cache: same commands in the same order");
+	if (rj != NULL) rjob_close (rj);
+	unlink ((path + RJOB_SUFFIX).c_str ());
+	unlink (path.c_str ());
+	rmdir (dir);
+}
+
+int main () {
+	helix_from_rest ();
+	step_down_in_order ();
+	stream_matches_cache ();
+	if (failures) printf ("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+	return failures ? 1 : 0;
+}
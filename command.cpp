@@ -1,6 +1,13 @@
 #include "command.h"
+#include "ir.h"
+#include "schema.h"
 #include "host.h"
+#include "workpool.h"
+#include "gtoken.h"
 #include <climits>
+#include <cstring>
+#include <strings.h>
+#include <utility>
 using namespace std;
 
 /* A command is COM_SIZE (currently 20) bytes. 
@@ -33,88 +40,244 @@ void getfloat (uchar *p, float f) {
 	p[3] = src[0];
 }
 
-/* These are various functions for initializing a command_t. They correspond to the various
-*  arrangements of data that occur for different command types. */
+// the inverse of getfloat: pull a big endian float back out of a command
+float cmd_getfloat (const command_t *c, int off) {
+	float f;
+	uchar *dst = (uchar *) &f;
+	dst[0] = c->bytes[off+3];
+	dst[1] = c->bytes[off+2];
+	dst[2] = c->bytes[off+1];
+	dst[3] = c->bytes[off];
+	return f;
+}
+
+/* Every command's layout is described by its entry in cmd_schema (schema.h), and the code
+ * that deals with each one is instantiated from that entry: an encoder (ircmd_t -> frame), a
+ * decoder (frame -> ircmd_t) and the parser's operand handling. The entry is a compile time
+ * constant, so the loops over operands unroll and the switches on their types fold away,
+ * leaving straight-line code for each opcode; the frame is built in a single pass and its
+ * checksum worked out once. */
+
+static inline void put_be (uchar *p, uint32_t v, int n) {
+	for (int i=0; i < n; i++) {
+		p[i] = (uchar) (v >> (8 * (n - 1 - i)));
+	}
+}
+
+static inline uint32_t get_be (const uchar *p, int n) {
+	uint32_t v = 0;
+	for (int i=0; i < n; i++) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+template <int K>
+static command_t encode_k (const ircmd_t *c, unsigned short id) {
+	constexpr cmdschema_t s = cmd_schema[K];
+	constexpr int n = schema_nargs (s);
+	command_t x;
+	memset (x.bytes, 0, COM_SIZE);
+	x.bytes[0] = s.op;
+	x.bytes[1] = (uchar) (id >> 8);
+	x.bytes[2] = (uchar) id;
+	for (int i=0; i < n; i++) {
+		uchar *p = &x.bytes[arg_offset (s, i)];
+		if (s.arg[i] == ARG_STR) {
+			memcpy (p, c->a.s, COM_STRLEN_MAX);
+		} else if (s.arg[i] == ARG_F32) {
+			uint32_t v;
+			memcpy (&v, &c->a.f[i], 4);
+			put_be (p, v, 4);
+		} else {
+			put_be (p, (uint32_t) c->a.i[i], arg_size (s.arg[i]));
+		}
+	}
+	checksum (&x);
+	return x;
+}
+
+template <int K>
+static void decode_k (const command_t *x, ircmd_t *c) {
+	constexpr cmdschema_t s = cmd_schema[K];
+	constexpr int n = schema_nargs (s);
+	memset (c, 0, sizeof(*c));
+	c->op = s.op;
+	for (int i=0; i < n; i++) {
+		const uchar *p = &x->bytes[arg_offset (s, i)];
+		switch (s.arg[i]) {
+			case ARG_STR:	memcpy (c->a.s, p, COM_STRLEN_MAX);	break;
+			case ARG_F32: {
+				uint32_t v = get_be (p, 4);
+				memcpy (&c->a.f[i], &v, 4);
+				break;
+			}
+			case ARG_S8:	c->a.i[i] = (signed char) p[0];	break;
+			default:		c->a.i[i] = (int32_t) get_be (p, arg_size (s.arg[i]));	break;
+		}
+	}
+}
+
+// read the operands of a G-code line (s is just past the opcode). Numbers are cast to the size
+// they'll have in the frame, as the firmware would see them.
+template <int K>
+static void parse_k (const char *s, const char *lbp, ircmd_t *c) {
+	constexpr cmdschema_t sc = cmd_schema[K];
+	constexpr int n = schema_nargs (sc);
+	for (int i=0; i < n; i++) {
+		switch (sc.arg[i]) {
+			case ARG_F32:	c->a.f[i] = scan_float (s, lbp, &s);	break;
+			case ARG_U8:	c->a.i[i] = (unsigned char) scan_long (s, lbp, &s);	break;
+			case ARG_S8:	c->a.i[i] = (char) scan_long (s, lbp, &s);	break;
+			case ARG_U16:	c->a.i[i] = (unsigned short) scan_long (s, lbp, &s);	break;
+			case ARG_U32:	c->a.i[i] = (unsigned int) scan_long (s, lbp, &s);	break;
+			case ARG_AXES: {
+				int axes = 0;
+				while (s < lbp && (*s == ' ' || *s == '\t')) s++;
+				for (; s < lbp; s++) {
+					if (*s == 'x') {
+						axes |= 1;
+					} else if (*s == 'y') {
+						axes |= 2;
+					} else if (*s == 'z') {
+						axes |= 4;
+					} else {
+						break;
+					}
+				}
+				c->a.i[i] = axes;
+				break;
+			}
+			case ARG_STR:
+				if (s < lbp && *s == ' ') s++;	// one space separates the opcode from the string
+				if (lbp - s > COM_STRLEN_MAX) {
+					log_warn ("Warning: echo string too long (can only fit %d bytes)", COM_STRLEN_MAX);
+					lbp = s + COM_STRLEN_MAX;
+				}
+				memcpy (c->a.s, s, lbp - s);
+				break;
+		}
+	}
+}
+
+typedef command_t (*cmd_encoder_t) (const ircmd_t *, unsigned short);
+typedef void (*cmd_decoder_t) (const command_t *, ircmd_t *);
+typedef void (*cmd_parser_t) (const char *, const char *, ircmd_t *);
+
+typedef struct {
+	cmd_encoder_t encode[N_SCHEMA];
+	cmd_decoder_t decode[N_SCHEMA];
+	cmd_parser_t parse[N_SCHEMA];
+} codecs_t;
+
+template <size_t... K>
+static constexpr codecs_t make_codecs (index_sequence<K...>) {
+	return {{encode_k<K>...}, {decode_k<K>...}, {parse_k<K>...}};
+}
+static constexpr codecs_t codecs = make_codecs (make_index_sequence<N_SCHEMA> ());
+
+// the frame for a command, with the given ID
+command_t cmd_encode (const ircmd_t *c, unsigned short id) {
+	int k = schema_index.k[c->op];
+	if (k < 0) return cmd_init (c->op, id);
+	return codecs.encode[k] (c, id);
+}
+
+// and back again. Returns false for an opcode we don't know.
+bool cmd_decode (const command_t *x, ircmd_t *c) {
+	int k = schema_index.k[x->bytes[0]];
+	if (k < 0) return false;
+	codecs.decode[k] (x, c);
+	return true;
+}
+
+/* These are various functions for initializing a command_t, for when there's no parsed
+ * command to start from. They all go through cmd_encode, so the layout still comes from
+ * the schema. */
 
 // initialize a command with no data - just a opcode, id, and checksum.
 command_t cmd_init (char op, unsigned short id) {
 	command_t c;
 	memset (c.bytes, 0, COM_SIZE);
 	c.bytes[0] = op;
-	c.bytes[1] = (uchar) id >> 8;
+	c.bytes[1] = (uchar) (id >> 8);
 	c.bytes[2] = (uchar) id;
 	checksum (&c);
 	return c;
 }
 
+// restamp the ID of an already-built command (and fix up the checksum)
+void cmd_setid (command_t *c, unsigned short id) {
+	c->bytes[1] = (uchar) (id >> 8);
+	c->bytes[2] = (uchar) id;
+	checksum (c);
+}
+
+static inline ircmd_t ircmd (char op, int32_t a = 0, int32_t b = 0) {
+	ircmd_t c;
+	memset (&c, 0, sizeof(c));
+	c.op = op;
+	c.a.i[0] = a;
+	c.a.i[1] = b;
+	return c;
+}
+
 // create a command with one byte of data
 command_t cmd_initb (char op, unsigned short id, char b) {
-	command_t c = cmd_init (op, id);
-	c.bytes[3] = b;
-	checksum (&c);
-	return c;
+	ircmd_t c = ircmd (op, (uchar) b);
+	return cmd_encode (&c, id);
 }
 
 // create a command with one 2-byte integer field. 
 command_t cmd_inits (char op, unsigned short id, unsigned short x) {
-	command_t c = cmd_init (op, id);
-	c.bytes[3] = x >> 8;
-	c.bytes[4] = x;
-	checksum (&c);
-	return c;
+	ircmd_t c = ircmd (op, x);
+	return cmd_encode (&c, id);
 }
 
 // create a command with two 2-byte integer fields.
 command_t cmd_init2s (char op, unsigned short id, unsigned short x, unsigned short y) {
-	command_t c = cmd_init (op, id);
-	c.bytes[3] = x >> 8;
-	c.bytes[4] = x;
-	c.bytes[5] = y >> 8;
-	c.bytes[6] = y;
-	checksum (&c);
-	return c;
+	ircmd_t c = ircmd (op, x, y);
+	return cmd_encode (&c, id);
+}
+
+// create a command with one 4-byte integer field.
+command_t cmd_initl (char op, unsigned short id, unsigned int x) {
+	ircmd_t c = ircmd (op, (int32_t) x);
+	return cmd_encode (&c, id);
 }
 
 command_t cmd_initf (char op, unsigned short id, float a) {
-	command_t c = cmd_init (op, id);
-	getfloat (&c.bytes[3], a);
-	checksum (&c);
-	return c;
+	ircmd_t c = ircmd (op);
+	c.a.f[0] = a;
+	return cmd_encode (&c, id);
 }
 
 command_t cmd_init3fb (char op, unsigned short id, float a, float b, float c, char d) {
-	command_t x = cmd_init (op, id);
-	getfloat (&x.bytes[3], a);
-	getfloat (&x.bytes[7], b);
-	getfloat (&x.bytes[11], c);
-	x.bytes[15] = d;
-	checksum (&x);
-	return x;
+	ircmd_t x = ircmd (op);
+	x.a.f[0] = a;
+	x.a.f[1] = b;
+	x.a.f[2] = c;
+	x.a.i[3] = d;
+	return cmd_encode (&x, id);
 }
 
 command_t cmd_init4f (char op, unsigned short id, float x, float y, float z, float f) {
-	command_t c = cmd_init (op, id);
-	getfloat (&c.bytes[3], x);
-	getfloat (&c.bytes[7], y);
-	getfloat (&c.bytes[11], z);
-	getfloat (&c.bytes[15], f);
-	checksum (&c);
-	return c;
+	ircmd_t c = ircmd (op);
+	c.a.f[0] = x;
+	c.a.f[1] = y;
+	c.a.f[2] = z;
+	c.a.f[3] = f;
+	return cmd_encode (&c, id);
 }
 
 command_t cmd_init_str (char op, unsigned short id, char *s, char *e) {
 	if (e - s > COM_STRLEN_MAX) {
-		printf ("Warning: echo string too long (can only fit %d bytes)", COM_STRLEN_MAX);
+		log_warn ("Warning: echo string too long (can only fit %d bytes)", COM_STRLEN_MAX);
 		e = s + COM_STRLEN_MAX;
 	}
-	command_t c = cmd_init (op, id);
-	int i = COM_DATA_START;
-	while (s < e) {
-		c.bytes[i++] = *s;
-		s++;
-	}
-	checksum (&c);
-	return c;
+	ircmd_t c = ircmd (op);
+	memcpy (c.a.s, s, e - s);
+	return cmd_encode (&c, id);
 }
 
 /* Now for the Gcode parsing. This will take a string and attempt to convert it
@@ -124,131 +287,170 @@ int err = 0;	// a count of the number of errors on the most recent call to parse
 
 // output a warning message to stderr and to the console in the GUI
 void warning (int line, const char *message) {
-	console_append (string("Warning! ") + message);
-	fprintf (stderr, "Warning in line %d: %s\n", line, message);
+	log_warn ("Warning in line %d: %s", line, log_copy (message));
 	//err++;
 }
 
 // output an error message to stderr and to the console in the GUI
 void error (int line, const char *message) {
-	console_append (string("Error! ") + message);
-	fprintf (stderr, "ERROR in line %d: %s\n", line, message);
+	log_error ("ERROR in line %d: %s", line, log_copy (message));
 	err++;
 }
 
-#define N_OPS 33
-const char *ops[] = {"noop", "mova", "movr", "marc", "mhlx", "home", "clwo", "swox", "swoy", "crot", "srot", "edgx", "edgy", "efmx", "efmy", "ef2x", "ef2y", "stpe", "stpd", "spne", "spnd", "ssps", "wait", "wusr", "beep", "qpos", "qabs", "qwor", "qrot", "qend", "qsps", "echo", "stop"};
+/* Opcodes are looked up by their 4 characters packed into a 32-bit key, in a small open
+ * addressing hash table built from cmd_schema the first time it's needed. Lowercasing is done on
+ * all 4 bytes at once by setting bit 5 of every byte that has bit 6 set; that maps the
+ * capital letters onto the small ones and doesn't turn anything else into a letter or digit,
+ * so matches are the same as strncasecmp's. */
+#define OP_TABLE_BITS 7
+static uint32_t op_keys[1 << OP_TABLE_BITS];
+static signed char op_index[1 << OP_TABLE_BITS];
 
-// the main parsing routine. It's a bit of a mess of pointer manipulation and 
-// calls to C library routines with names with no vowels like strspn and strchr
+static inline uint32_t op_key (const char *s) {
+	uint32_t k;
+	memcpy (&k, s, 4);
+	return k | ((k & 0x40404040u) >> 1);
+}
 
-// the Textscroller parameter is used to update the display of the currently 
-// loaded gcode. If NULL is passed it will be ignored.
-vector<command_t> parse_gcode (char *s, Textscroller *gcode) {
-	err = 0;
-	vector<command_t> cmd;
+static inline unsigned int op_hash (uint32_t k) {
+	return (k * 0x9e3779b1u) >> (32 - OP_TABLE_BITS);
+}
 
-	float x, y, z, f;	// keeps track of the current position and feedrate
-	x = y = z = f = 0;
+static bool build_op_table () {
+	memset (op_index, -1, sizeof(op_index));
+	for (int i=0; i < N_SCHEMA; i++) {
+		uint32_t k = op_key (cmd_schema[i].name);
+		unsigned int h = op_hash (k);
+		while (op_index[h] != -1) h = (h + 1) & ((1 << OP_TABLE_BITS) - 1);
+		op_keys[h] = k;
+		op_index[h] = i;
+	}
+	return true;
+}
 
-	char *end = s + strlen(s);	// points to the end of the input string
-	char *lbp;	// linebreak pointer - will point to the end of the current line
-	int line = 0;
-	unsigned short id = 0;
+// index into cmd_schema of the opcode at s, or -1
+static int find_op (const char *s, const char *e) {
+	[[maybe_unused]] static bool built = build_op_table ();	// once, the first time through
+	if (e - s < 4) return -1;
+	uint32_t k = op_key (s);
+	for (unsigned int h = op_hash (k); op_index[h] != -1; h = (h + 1) & ((1 << OP_TABLE_BITS) - 1)) {
+		if (op_keys[h] == k) return op_index[h];
+	}
+	return -1;
+}
+
+/* The main parsing routine. It works on one line at a time (s up to e, not including the
+ * newline), so the same code serves parse_gcode and the streaming loader. The line doesn't
+ * need to be null terminated, and numbers are read with the scanners in gtoken.cpp, which
+ * never look past e, so a command that's short of arguments can't wander onto the next line.
+ * Returns 1 and fills in *c if the line is a command, 0 if it's blank, or -1 (with *msg set)
+ * if it's malformed. */
+int parse_gcode_line (const char *s, const char *lbp, ircmd_t *c, const char **msg) {
+	if (lbp - s > GCODE_LINE_MAX) lbp = s + GCODE_LINE_MAX;	// anything past this is ignored
+
+	while (s < lbp && (*s == ' ' || *s == '\t' || *s == '\r')) s++;	// skip leading whitespace
+	if (s == lbp) return 0;
+	// first 4 characters of the line are always the opcode
+	int k = find_op (s, lbp);
+	if (k == -1) {
+		*msg = "Bad opcode!";
+		return -1;
+	}
+	memset (&c->a, 0, sizeof(c->a));
+	c->op = cmd_schema[k].op;
+	codecs.parse[k] (s + 4, lbp, c);
+	return 1;
+}
+
+// parse one piece of a file (see gchunk_t)
+static void parse_chunk (gchunk_t *ch) {
+	ch->cmd.clear ();
+	ch->errors.clear ();
+	ch->cmd.reserve ((ch->e - ch->s) / 16);
+	const char *s = ch->s, *lbp;
+	int line = 0, newlines = 0;
+	linescan_t ls;
+	ls_init (&ls, ch->s, ch->e);
 	do {
 		line++;
-		id = cmd.size();
-		lbp = strchr (s, '\n');	// find the next newline
-		if (lbp == NULL) lbp = end;	// if not found, set the end of the current line to the end of the input string
-
-		if (gcode != NULL) {
-			gcode->append_line (string (s, (size_t) (lbp-s)));
+		lbp = ls_next (&ls);
+		if (lbp != ch->e) newlines++;
+		ircmd_t c;
+		const char *msg;
+		int r = parse_gcode_line (s, lbp, &c, &msg);
+		if (r > 0) {
+			c.line = line;
+			ch->cmd.push_back (c);
+		} else if (r < 0) {
+			gcode_error_t ge = {line, msg};
+			ch->errors.push_back (ge);
 		}
+		s = lbp + 1;
+	} while (lbp != ch->e);
+	ch->lines = newlines;
+}
 
-		s += strspn (s, " \t");	// skip leading whitespace
-		// first 4 characters of the line are always the opcode
-		int opcode = -1;
-		for (int i=0; i < N_OPS; i++) {
-			if (strncasecmp (s, ops[i], 4) == 0) {
-				opcode = i;
-				break;
-			}
+static void parse_chunk_item (void *arg, int i) {
+	parse_chunk (&(*(vector<gchunk_t> *) arg)[i]);
+}
+
+// cut s..e into at most 'max' pieces of about 'size' bytes, ending each one just after a newline.
+// Returns where the last piece ends (e, unless we ran out of pieces).
+const char *split_gcode (const char *s, const char *e, size_t size, int max, vector<gchunk_t> *out) {
+	for (int n=0; n < max; n++) {
+		gchunk_t ch;
+		ch.s = s;
+		ch.lines = 0;
+		const char *nl = NULL;
+		if ((size_t) (e - s) > size) {
+			nl = (const char *) memchr (s + size, '\n', e - (s + size));
 		}
-		if (opcode == -1) {
-			error (line, "Bad opcode!");
-		} else if (opcode == N_OPS - 1) {
-			opcode = 255;	// STOP
+		ch.e = nl ? nl + 1 : e;
+		out->push_back (ch);
+		s = ch.e;
+		if (s == e) break;
+	}
+	return s;
+}
+
+// parse all the pieces, spread over the work pool
+void parse_gcode_chunks (vector<gchunk_t> *chunks) {
+	pool_run (chunks->size (), parse_chunk_item, chunks);
+}
+
+// parse a whole string of gcode into a job. The Textscroller parameter is used to update
+// the display of the currently loaded gcode. If NULL is passed it will be ignored.
+void parse_gcode (char *s, Textscroller *gcode, jobir_t *out) {
+	err = 0;
+	char *end = s + strlen(s);	// points to the end of the input string
+	vector<gchunk_t> chunks;
+	split_gcode (s, end, PARSE_CHUNK, INT_MAX, &chunks);
+	parse_gcode_chunks (&chunks);
+
+	// stitch the pieces together: line numbers carry on from one piece to the next
+	ir_clear (out);
+	int line0 = 0;
+	for (size_t i=0; i < chunks.size(); i++) {
+		gchunk_t *ch = &chunks[i];
+		for (size_t k=0; k < ch->errors.size(); k++) {
+			error (line0 + ch->errors[k].line, ch->errors[k].msg);
 		}
-		int homeaxes = 0;
-		switch (opcode) {
-			case MOVA:
-			case MOVR:
-			case MARC:
-			case MHLX:
-				cmd.push_back (cmd_init4f (opcode, id++, strtof (s, &s), strtof(s, &s), strtof(s, &s), strtof(s, &s)));
-				break;
-			case HOME:
-				homeaxes = 0;
-				while (s < lbp) {
-					if (s[0] == 'x') {
-						homeaxes |= 1;
-					} else if (s[0] == 'y') {
-						homeaxes |= 2;
-					} else if (s[0] == 'z') {
-						homeaxes |= 4;
-					} else {
-						break;
-					}
-					s++;
-				}
-				cmd.push_back (cmd_initb (opcode, id++, (unsigned char) homeaxes));
-				break;
-			case SWOX:
-			case SWOY:
-			case SROT:
-			case EDGX:
-			case EDGY:
-				cmd.push_back (cmd_initf (opcode, id++, strtof (s, &s)));
-				break;
-			case EFMX:
-			case EFMY:
-			case EF2X:
-			case EF2Y:
-				cmd.push_back (cmd_init3fb (opcode, id++, strtof (s, &s), strtof(s, &s), strtof(s, &s), (char) strtol (s, &s, 10)));
-				break;
-			case NOOP:
-			case CLWO:
-			case CROT:
-			case STPE:
-			case STPD:
-			case SPNE:
-			case SPND:
-			case QPOS:
-			case QABS:
-			case QWOR:
-			case QROT:
-			case QEND:
-			case QSPS:
-			case STOP:
-				cmd.push_back (cmd_init (opcode, id++));
-				break;
-			case SSPS:
-			case WAIT:
-				cmd.push_back (cmd_inits (opcode, id++, (unsigned short) strtol (s, &s, 10)));
-				break;
-			case WUSR:
-				cmd.push_back (cmd_initb (opcode, id++, (unsigned char) strtol (s, &s, 10)));
-				break;
-			case BEEP:
-				cmd.push_back (cmd_init2s (opcode, id++, (unsigned short) strtol (s, &s, 10), (unsigned short) strtol (s, &s, 10)));
-				break;
-			case ECHO:
-				cmd.push_back (cmd_init_str (opcode, id++, s, lbp));
-				break;
+		for (size_t k=0; k < ch->cmd.size(); k++) {
+			ch->cmd[k].line += line0;
+			ir_push (out, &ch->cmd[k]);
 		}
-		s = lbp + 1;
-	} while (lbp != end);
-	return cmd;
+		line0 += ch->lines;
+	}
+
+	if (gcode != NULL) {
+		char *lbp;
+		do {
+			lbp = (char *) memchr (s, '\n', end - s);
+			if (lbp == NULL) lbp = end;
+			gcode->append_line (string (s, (size_t) (lbp-s)));
+			s = lbp + 1;
+		} while (lbp != end);
+	}
 }
 
 void cmd_println (command_t c) {
@@ -258,11 +460,62 @@ void cmd_println (command_t c) {
 	printf ("\n");
 }
 
+// the shortest text for f that reads back as the same float
+static int print_float (char *buf, int size, float f) {
+	int n = 0;
+	for (int prec = 6; prec <= 9; prec++) {
+		n = snprintf (buf, size, "%.*g", prec, f);
+		if (strtof (buf, NULL) == f) break;
+	}
+	return n;
+}
+
+/* Write c out as a line of G-code (without the newline), the way the parser would read it
+ * back. Returns the length, as snprintf does. */
+int cmd_format (const ircmd_t *c, char *buf, int size) {
+	const cmdschema_t *s = cmd_schema_of (c->op);
+	if (s == NULL) return snprintf (buf, size, "(opcode %d)", c->op);
+	int n = snprintf (buf, size, "%s", s->name);
+	for (int i=0; i < schema_nargs (*s) && n < size; i++) {
+		char *p = buf + n;
+		int room = size - n;
+		switch (s->arg[i]) {
+			case ARG_F32:
+				n += snprintf (p, room, " ");
+				if (n < size) n += print_float (buf + n, size - n, c->a.f[i]);
+				break;
+			case ARG_AXES:
+				n += snprintf (p, room, " %s%s%s", (c->a.i[i] & 1) ? "x" : "", (c->a.i[i] & 2) ? "y" : "", (c->a.i[i] & 4) ? "z" : "");
+				break;
+			case ARG_STR:
+				n += snprintf (p, room, " %.*s", (int) strnlen (c->a.s, COM_STRLEN_MAX), c->a.s);
+				break;
+			default:
+				n += snprintf (p, room, " %d", c->a.i[i]);
+				break;
+		}
+	}
+	return n;
+}
+
+// a frame as readable text: its ID and what it says
 string cmd_getstring (command_t c) {
-	char s[50];
-	char *ptr = s;
-	for (int i=0; i < COM_SIZE; i++) {
-		ptr += sprintf (ptr, "%d ", c.bytes[i]);
+	ircmd_t ic;
+	if (!cmd_decode (&c, &ic)) {
+		memset (&ic, 0, sizeof(ic));
+		ic.op = c.bytes[0];
 	}
+	char s[80];
+	int n = snprintf (s, sizeof(s), "#%d ", (c.bytes[1] << 8) | c.bytes[2]);
+	cmd_format (&ic, s + n, sizeof(s) - n);
 	return string (s);
 }
+
+uint64_t fnv_hash (const void *p, size_t len) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	const uchar *b = (const uchar *) p;
+	for (size_t i=0; i < len; i++) {
+		h = (h ^ b[i]) * 0x100000001b3ull;
+	}
+	return h;
+}
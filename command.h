@@ -6,10 +6,12 @@
 #include "gui.h"
 #include <vector>
 #include <string>
+#include <stdint.h>
 
 #define COM_SIZE 20
 #define COM_DATA_START 3
 #define COM_STRLEN_MAX 15
+#define GCODE_LINE_MAX 255	// longest line of gcode the parser looks at; the rest is ignored
 
 typedef unsigned char uchar;
 typedef struct {
@@ -17,20 +19,65 @@ typedef struct {
 } command_t;
 
 //typedef enum {NOP, MOVE, RELMOVE, HOME, STEPPERS_ONOFF, SPINDLE_ONOFF, WAIT, PAUSE, BEEP, SET_POSITION, GET_POSITION, GET_ENDSTOPS, GET_SPINDLE_SPEED, ECHO=16, ESTOP=255} comtype_t;
-typedef enum {NOOP, MOVA, MOVR, MARC, MHLX, HOME, CLWO, SWOX, SWOY, CROT, SROT, EDGX, EDGY, EFMX, EFMY, EF2X, EF2Y, STPE, STPD, SPNE, SPND, SSPS, WAIT, WUSR, BEEP, QPOS, QABS, QWOR, QROT, QEND, QSPS, ECHO, STOP=255} comtype_t;
+typedef enum {NOOP, MOVA, MOVR, MARC, MHLX, HOME, CLWO, SWOX, SWOY, CROT, SROT, EDGX, EDGY, EFMX, EFMY, EF2X, EF2Y, STPE, STPD, SPNE, SPND, SSPS, WAIT, WUSR, BEEP, QPOS, QABS, QWOR, QROT, QEND, QSPS, ECHO, SPRV, QBDR, SBDR, STOP=255} comtype_t;
+
+#define CMD_MAX_ARGS 4
+
+/* A command as the host works with it, before it's encoded for the wire: the opcode, its
+ * operands (floats or integers depending on the opcode, or ECHO's string in their bytes), and
+ * the line it came from. The parser produces these and everything that looks at a job works
+ * on them; the frame, with its ID and checksum, is only made by cmd_encode as it's sent. */
+typedef struct {
+	uchar op;
+	int line;
+	union {
+		float f[CMD_MAX_ARGS];
+		int32_t i[CMD_MAX_ARGS];
+		char s[CMD_MAX_ARGS * 4];
+	} a;
+} ircmd_t;
 
 void cmd_println (command_t c);
 string cmd_getstring (command_t c);
 
-std::vector<command_t> parse_gcode (char *, Textscroller *);
+#define PARSE_CHUNK (256 * 1024)	// bytes of gcode per piece when parsing in parallel
+
+typedef struct {
+	int line;
+	const char *msg;
+} gcode_error_t;
+
+/* Big inputs are split at line boundaries into pieces that are parsed separately (and in
+ * parallel), then stitched back together. Lines are numbered from 1 within each piece; the
+ * stitching adds the real starting line. */
+typedef struct {
+	const char *s, *e;			// the text, which starts at the beginning of a line
+	std::vector<ircmd_t> cmd;
+	std::vector<gcode_error_t> errors;
+	int lines;					// newlines in the piece
+} gchunk_t;
+
+struct jobir_t;
+void parse_gcode (char *, Textscroller *, jobir_t *out);
+int parse_gcode_line (const char *s, const char *e, ircmd_t *c, const char **msg);
+const char *split_gcode (const char *s, const char *e, size_t size, int max, std::vector<gchunk_t> *out);
+void parse_gcode_chunks (std::vector<gchunk_t> *);
 
 command_t cmd_init   (char op, unsigned short id);
 command_t cmd_initb  (char op, unsigned short id, char b);
 command_t cmd_inits  (char op, unsigned short id, unsigned short);
 command_t cmd_init2s (char op, unsigned short id, unsigned short, unsigned short);
 command_t cmd_initf  (char op, unsigned short id, float);
+command_t cmd_initl  (char op, unsigned short id, unsigned int);
 command_t cmd_init3fb (char op, unsigned short id, float a, float b, float c, char d);
 command_t cmd_init4f (char op, unsigned short id, float, float, float, float);
 command_t cmd_init_str (char op, unsigned short id, char *start, char *end);
+void cmd_setid (command_t *c, unsigned short id);
+command_t cmd_encode (const ircmd_t *c, unsigned short id);
+bool cmd_decode (const command_t *x, ircmd_t *c);
+int cmd_format (const ircmd_t *c, char *buf, int size);
+float cmd_getfloat (const command_t *c, int off);
+
+uint64_t fnv_hash (const void *p, size_t len);	// FNV-1a, which the *_settings_hash functions make of their settings
 
 #endif
@@ -0,0 +1,104 @@
+#include "compact.h"
+#include <cmath>
+#include <cstring>
+
+/* See the 'new_protocol' file for the frame layout. Coordinates go out as fixed point in
+ * units of 0.01 mm (angles in 0.01 degree), as zigzag varints: 7 bits per byte, least
+ * significant first, high bit set on all but the last byte. */
+
+void compact_reset (compact_state_t *st) {
+	memset (st, 0, sizeof(compact_state_t));
+}
+
+static inline int fixed (float v) {
+	return (int) lrintf (v * 100);
+}
+
+static uchar *put_varint (uchar *p, unsigned int v) {
+	while (v >= 0x80) {
+		*p++ = (uchar) (v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uchar) v;
+	return p;
+}
+
+static inline uchar *put_zigzag (uchar *p, int v) {
+	return put_varint (p, ((unsigned int) v << 1) ^ (unsigned int) (v >> 31));
+}
+
+// the feedrate only goes out if it's different from the last one we sent
+static uchar *put_feed (compact_state_t *st, uchar *flags, uchar *p, float f) {
+	int fx = fixed (f);
+	if (fx != st->f) {
+		*flags |= 8;
+		p = put_varint (p, (unsigned int) fx);
+		st->f = fx;
+	}
+	return p;
+}
+
+// encode c into out (which must have room for COMPACT_MAX_FRAME bytes). Returns the frame length.
+int compact_encode (compact_state_t *st, const command_t *c, uchar *out) {
+	uchar op = c->bytes[0];
+	if (op == STOP) {
+		out[0] = COMPACT_STOP;
+		return 1;
+	}
+	out[1] = op;
+	out[2] = c->bytes[2];	// low byte of the ID; that's all the ACK carries anyway
+	uchar *p = &out[3];
+
+	if (op == MOVA || op == MOVR) {
+		uchar *flags = p++;
+		*flags = 0;
+		// each movr is rounded to 0.01 mm, and the error carried into the next one, so a run
+		// of them doesn't wander off from where they add up to
+		int v[3];
+		for (int i=0; i < 3; i++) {
+			float exact = cmd_getfloat (c, COM_DATA_START + 4*i) * 100;
+			if (op == MOVR) exact += st->res[i];
+			v[i] = (int) lrintf (exact);
+			st->res[i] = exact - v[i];
+		}
+		int d[3] = {v[0], v[1], v[2]};
+		if (op == MOVA) {
+			d[0] -= st->x;	d[1] -= st->y;	d[2] -= st->z;
+			st->x = v[0];	st->y = v[1];	st->z = v[2];
+		}
+		for (int i=0; i < 3; i++) {
+			if (d[i] != 0) {
+				*flags |= 1 << i;
+				p = put_zigzag (p, d[i]);
+			}
+		}
+		p = put_feed (st, flags, p, cmd_getfloat (c, COM_DATA_START + 12));
+	} else if (op == MARC || op == MHLX) {
+		uchar dummy;
+		uchar *flags = (op == MARC) ? p++ : &dummy;	// only MARC has a feedrate to leave out
+		*flags = 0;
+		p = put_varint (p, (unsigned int) fixed (fabsf (cmd_getfloat (c, COM_DATA_START))));
+		p = put_zigzag (p, fixed (cmd_getfloat (c, COM_DATA_START + 4)));
+		p = put_zigzag (p, fixed (cmd_getfloat (c, COM_DATA_START + 8)));
+		if (op == MARC) {
+			p = put_feed (st, flags, p, cmd_getfloat (c, COM_DATA_START + 12));
+		} else {
+			p = put_zigzag (p, fixed (cmd_getfloat (c, COM_DATA_START + 12)));	// lead
+		}
+	} else {
+		// everything else is short already; just drop the trailing zeros from the data
+		int n = COM_SIZE - 1;
+		while (n > COM_DATA_START && c->bytes[n-1] == 0) n--;
+		memcpy (p, &c->bytes[COM_DATA_START], n - COM_DATA_START);
+		p += n - COM_DATA_START;
+	}
+
+	int len = p - out + 1;
+	out[0] = (uchar) (len - 1);
+	uchar cs = 0;
+	for (int i=0; i < len - 1; i++) {
+		cs ^= out[i];
+	}
+	out[len - 1] = cs;
+	return len;
+}
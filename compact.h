@@ -0,0 +1,28 @@
+/* compact.h - the variable length (protocol v3) wire encoding of commands */
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include "command.h"
+#include <cmath>
+
+#define COMPACT_MAX_FRAME 25	// len, opcode, id, flags, four 5-byte varints, checksum
+#define COMPACT_STOP 0xff		// sent on its own in place of a length byte
+
+/* Moves are encoded relative to what was sent before, so the encoder has to remember what
+ * it told the firmware last. The firmware keeps the same state; both start from zero when
+ * v3 is switched on, and again after an abort. */
+typedef struct {
+	int x, y, z;	// target of the last MOVA, in 0.01 mm
+	int f;			// last feedrate sent, in 0.01 mm/sec
+	float res[3];	// how far (in 0.01 mm) the firmware's idea of where it is trails ours, from rounding
+} compact_state_t;
+
+// x as the v3 frames carry it: rounded to 0.01 (mm or degrees)
+static inline double hundredths (double x) {
+	return rint (x * 100) / 100;
+}
+
+void compact_reset (compact_state_t *st);
+int compact_encode (compact_state_t *st, const command_t *c, uchar *out);
+
+#endif
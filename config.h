@@ -2,8 +2,19 @@
 #define CONFIG_H
 
 #define BAUDRATE 9600	// must match setting in firmware
+#define BAUD_MAX 1000000	// after connecting, step up to the fastest rate up to this that the firmware can do (<= BAUDRATE to stay put)
+#define BAUD_ERROR_MAX 0.02f	// drop to a slower rate if more than this fraction of frames get garbled
 #define SERIAL_PORT_NAME "/dev/tty.usbmodem1421"	// ideally this should be selectable at runtime
 
+// maximum number of commands allowed in flight (sent but not yet ACKed) at once. The firmware
+// can only buffer BUFFER_SIZE commands, so going deeper than that doesn't buy anything. Must be < 256,
+// since ACKs only carry the low byte of the command ID.
+#define TX_WINDOW BUFFER_SIZE
+
+// newest wire format to offer the firmware when connecting (see 'new_protocol'). 3 is the compact
+// variable length format; set this to 2 to always use the fixed 20-byte frames.
+#define PROTOCOL_VERSION 3
+
 #define SP_SPEED_MIN 0
 #define SP_SPEED_MAX 12000
 
@@ -18,14 +29,67 @@
 // if you're nice, you'll set these feedrates to correspond to the strings above.
 const float FEEDRATES[3] = {0.5f, 4, 20};
 
+/* TRAVEL OPTIMIZATION (see travel.h). Done to loaded jobs before anything else. */
+#define OPT_TRAVEL true	// reorder the cutting regions between barriers to cut the travel between them; false keeps the job's order
+#define OPT_REVERSE false	// also cut regions backwards where that helps (turns a retract into a plunge: only for cutters that can)
+#define OPT_CLEARANCE 3.0	// mm: regions that come this close (about a cutter's width) are cut in the order they're written
+#define OPT_MIN_LIFT 0.5	// mm: a block whose Z doesn't vary by this much has no safe height, and is left alone
+#define OPT_EFFORT 50000000	// changes to the order tried per block (per attempt); this alone bounds the time it takes, so the same job always gets the same order
+#define OPT_ATTEMPTS 8		// orders tried for each block, each from a different first region (spread over the work pool's threads)
+#define OPT_MAX_REGIONS 10000	// more regions than this in one block and it's left alone
+#define OPT_MAX_BLOCK (1 << 20)	// most moves held in one block (more and it's reordered in pieces)
+
+/* ARC LINEARIZATION (see linearize.h). For firmware that's too slow doing arcs itself. */
+#define ARC_LINEARIZE false	// send MARC/MHLX in loaded jobs as short straight moves (and don't fit arcs)
+#define LINEARIZE_TOLERANCE 0.005	// mm: the furthest a piece may cut inside the arc
+#define LINEARIZE_RATE 400	// moves/sec the link and the firmware can keep up with; an arc isn't cut finer than that
+
+/* ARC FITTING (see arcfit.h). Done to loaded jobs after travel optimization. */
+#define ARCFIT_ARCS false	// send runs of moves that follow a circle or helix as one MARC/MHLX (so the path may stray by up to ARCFIT_TOLERANCE); false leaves them be
+#define ARCFIT_TOLERANCE 0.01	// mm: the furthest the arc may be from any point of the moves it stands in for
+#define ARCFIT_MIN_MOVES 4	// fewest moves worth making an arc of
+#define ARCFIT_MAX_RUN 512	// most moves one arc may stand in for (the pass takes time in proportion to this)
+#define ARCFIT_MAX_RADIUS 1000	// mm
+
+/* TOOLPATH SIMPLIFICATION (see simplify.h). Done to loaded jobs after arc fitting. */
+#define SIMPLIFY_PATHS false	// merge runs of nearly collinear moves (so the path may stray by up to SIMPLIFY_TOLERANCE); false leaves them all in
+#define SIMPLIFY_TOLERANCE 0.01	// mm: the furthest a merged move may stray from the path as written
+#define SIMPLIFY_MAX_RUN 256	// most moves merged into one (the pass takes time in proportion to this)
+
+/* MOTION PLANNING (see planner.h). Limits are per axis: X, Y, Z. */
+#define PLAN_MOTION false	// plan feedrates for loaded jobs (set the limits below to your machine's first); false sends them as the G-code has them
+const float PLAN_ACCEL[3] = {500, 500, 200};	// mm/sec^2
+const float PLAN_JERK[3] = {5, 5, 2};		// mm/sec: the most the speed along an axis may jump at once (at a corner, starting or stopping)
+#define PLAN_MIN_PIECE 1.0f	// mm: the shortest piece a move will be split into
+#define PLAN_LOOKAHEAD 1024	// moves planned together
+
+/* TIME ESTIMATES (see estimate.h). Made for loaded jobs after everything else. */
+#define EST_HOME_TIME 15.0	// seconds a HOME takes (it depends on how far the axes are from home)
+#define EST_EDGEFIND_TIME 10.0	// seconds an edgefind takes (twice this for EFM and EF2)
+#define EST_CMD_TIME 0.0025	// seconds: the least any command takes, getting it over the link and through the firmware
+#define ETA_INTERVAL 1000	// ms between updates of the ETA shown while a job runs
+#define PROFILE_JOBS true	// time every command of a running job, and write <file>.profile.csv and .json under ~/.cache/routerhost/profiles at the end (see profile.h)
+
+/* SOFT LIMITS (see dryrun.h). In machine coordinates (HOME puts an axis at 0): set them to your machine's travel. */
+#define SOFT_LIMITS true	// check a job against them before it's run, and don't run it if it goes outside
+const float SOFT_MIN[3] = {0, 0, -100};	// mm
+const float SOFT_MAX[3] = {600, 400, 50};	// mm
+
+/* RESUMING A JOB (see resume.h) */
+#define RESUME_TRAVEL_FEED 20	// mm/sec going over to where the job carries on, with Z homed
+#define RESUME_PLUNGE_FEED 2	// mm/sec coming down to it
+#define RESUME_SPINUP 3000	// ms given the spindle to get up to speed
+
 /* GUI CONFIGURATION */
 #define DEFAULT_WIN_XS 800
 #define DEFAULT_WIN_YS 600
 
 #define TS_LINE_HT 18	// height in pixels of a line of text in a Textscroller component
 #define MIN_SCROLLBAR_HT 15	// minimum size of the scrollbar
+#define GCODE_VIEW_LINES 10000	// lines of a loaded file to show in the gcode view
 
-// what to display in the console
+// what to display in the console (these are just the starting points; see log_enable in logger.h)
+#define LOG_MIN_LEVEL 0	// least important messages to keep: 0 = debug, 1 = info, 2 = warnings, 3 = errors
 #define CONSOLE_ACK true
 #define CONSOLE_PING true
 #define CONSOLE_SEND true
@@ -0,0 +1,110 @@
+#include "dryrun.h"
+#include "logger.h"
+#include <cmath>
+using namespace std;
+
+void dry_init (dryrun_t *d, const postrack_t *start) {
+	d->pos = *start;
+	d->n = 0;
+	d->moves = d->unchecked = d->violations = 0;
+	d->first.clear ();
+}
+
+/* Check the batch, and go through it again for the details if anything's out. The loops
+ * always go over the whole batch (a short one is filled out with boxes that pass), since a
+ * fixed count is what gets them vectorized at -O2. */
+static void check (dryrun_t *d) {
+	int n = d->n;
+	for (int a=0; a < 3; a++) {
+		for (int i=n; i < DRY_BATCH; i++) d->lo[a][i] = d->hi[a][i] = NAN;
+	}
+	uchar bad[DRY_BATCH];
+	for (int i=0; i < DRY_BATCH; i++) bad[i] = 0;
+	for (int a=0; a < 3; a++) {
+		const float *lo = d->lo[a], *hi = d->hi[a];
+		float mn = SOFT_MIN[a] - DRY_SLACK, mx = SOFT_MAX[a] + DRY_SLACK;
+		for (int i=0; i < DRY_BATCH; i++) {
+			bad[i] |= (lo[i] < mn) | (hi[i] > mx);
+		}
+	}
+	uchar any = 0;
+	for (int i=0; i < DRY_BATCH; i++) any |= bad[i];
+	d->n = 0;
+	if (!any) return;
+	for (int i=0; i < n; i++) {
+		if (!bad[i]) continue;
+		d->violations++;
+		if (d->first.size () >= DRY_MAX_REPORT) continue;
+		for (int a=0; a < 3; a++) {
+			bool low = d->lo[a][i] < SOFT_MIN[a] - DRY_SLACK;
+			if (low || d->hi[a][i] > SOFT_MAX[a] + DRY_SLACK) {
+				dryviol_t v = {d->line[i], a, low ? d->lo[a][i] : d->hi[a][i]};
+				d->first.push_back (v);
+				break;
+			}
+		}
+	}
+}
+
+// machine coordinate on axis a, or NaN if it isn't known
+static inline float machine (const postrack_t *p, int a) {
+	return p->known[a] && p->oknown[a] ? p->w[a] + p->o[a] : NAN;
+}
+
+void dry_push (dryrun_t *d, const ircmd_t *c) {
+	if (c->op != MOVA && c->op != MOVR && c->op != MARC && c->op != MHLX) {
+		pos_track (&d->pos, c);
+		return;
+	}
+	float s[3], e[3];
+	for (int a=0; a < 3; a++) s[a] = machine (&d->pos, a);
+	pos_track (&d->pos, c);
+	int k = d->n++;
+	bool known = true;
+	for (int a=0; a < 3; a++) {
+		e[a] = machine (&d->pos, a);
+		d->lo[a][k] = fminf (s[a], e[a]);
+		d->hi[a][k] = fmaxf (s[a], e[a]);
+		if (isnan (s[a]) || isnan (e[a])) {	// fminf and fmaxf would have taken the other end
+			d->lo[a][k] = d->hi[a][k] = NAN;
+			known = false;
+		}
+	}
+	if (c->op == MARC || c->op == MHLX) {	// take in the extremes it sweeps through
+		double r = fabs (c->a.f[0]), th = c->a.f[1], dth = c->a.f[2];
+		double cx = s[0] - r * cos (th * M_PI / 180), cy = s[1] - r * sin (th * M_PI / 180);
+		double from = fmin (th, th + dth), to = fmax (th, th + dth);
+		for (double q = ceil (from / 90) * 90; q <= to && q < from + 360 + 90; q += 90) {
+			int quad = ((int) (q / 90) % 4 + 4) % 4;	// 0: +X, 1: +Y, 2: -X, 3: -Y
+			int a = quad & 1;
+			if (isnan (d->lo[a][k])) continue;	// not known on that axis, and it stays that way
+			float v = a == 0 ? cx + (quad == 0 ? r : -r) : cy + (quad == 1 ? r : -r);
+			d->lo[a][k] = fminf (d->lo[a][k], v);
+			d->hi[a][k] = fmaxf (d->hi[a][k], v);
+		}
+	}
+	d->line[k] = c->line;
+	d->moves++;
+	if (!known) d->unchecked++;
+	if (d->n == DRY_BATCH) check (d);
+}
+
+void dry_finish (dryrun_t *d) {
+	if (d->n > 0) check (d);
+}
+
+void dry_report (const dryrun_t *d) {
+	static const char axis[3] = {'X', 'Y', 'Z'};
+	for (size_t i=0; i < d->first.size(); i++) {
+		const dryviol_t *v = &d->first[i];
+		log_error ("Line %d goes to %c %.2f, outside the machine's travel (%.2f to %.2f).", v->line, axis[v->axis],
+				v->value, SOFT_MIN[v->axis], SOFT_MAX[v->axis]);
+	}
+	if (d->violations > d->first.size ()) {
+		log_error ("... and %lu more moves outside the travel.", d->violations - (unsigned long) d->first.size ());
+	}
+	if (d->unchecked > 0) {
+		log_warn ("%lu of %lu moves couldn't be checked against the travel: the machine's position wasn't known (home it first).",
+				d->unchecked, d->moves);
+	}
+}
@@ -0,0 +1,45 @@
+/* dryrun.h - runs a job through on the host first, to find any move that would take the
+ * machine outside its travel (SOFT_MIN and SOFT_MAX in config.h) before the firmware finds it
+ * with an abort, halfway through the cut. */
+#ifndef DRYRUN_H
+#define DRYRUN_H
+
+#include "planner.h"
+#include <vector>
+
+#define DRY_BATCH 1024		// moves checked at once
+#define DRY_MAX_REPORT 8	// violations kept in detail
+#define DRY_SLACK 0.005f	// mm a move may go past a limit by before it counts (so rounding doesn't)
+
+/* Position and working origin are followed through the job the way the firmware does them
+ * (see pos_track), starting from where the machine is now. Every move is boxed in machine
+ * coordinates: a straight move by its ends, an arc by its ends and whichever of its extremes
+ * in X and Y it sweeps through. The boxes are checked against the limits DRY_BATCH at a time,
+ * in straight line loops over arrays the compiler can vectorize, and only a batch that fails
+ * is gone through again to say which move it was. An axis whose machine position isn't known
+ * (before homing, say, or after an edgefind) can't be checked; it's NaN in the box, which
+ * passes every test, and the move is counted as unchecked. The rotation and skew corrections
+ * aren't modelled. */
+typedef struct {
+	int line;
+	int axis;		// 0, 1, 2 for X, Y, Z
+	float value;	// the machine coordinate it gets to
+} dryviol_t;
+
+typedef struct {
+	postrack_t pos;
+	float lo[3][DRY_BATCH], hi[3][DRY_BATCH];	// the batch's boxes, by axis
+	int line[DRY_BATCH];
+	int n;
+	unsigned long moves;		// moves checked so far
+	unsigned long unchecked;	// and ones on an axis that couldn't be
+	unsigned long violations;	// moves that go outside the limits
+	std::vector<dryviol_t> first;	// the first DRY_MAX_REPORT of them
+} dryrun_t;
+
+void dry_init (dryrun_t *, const postrack_t *start);
+void dry_push (dryrun_t *, const ircmd_t *);
+void dry_finish (dryrun_t *);
+void dry_report (const dryrun_t *);	// log what it found
+
+#endif
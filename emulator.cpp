@@ -0,0 +1,474 @@
+#include "emulator.h"
+#include "config.h"
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+using namespace std;
+
+/* This pretends to be the firmware on the other end of a pty, so the host can be exercised
+ * without a router attached. It models the things that matter for throughput:
+ *  - the serial line: every byte takes 10 bit times to cross, in each direction
+ *  - the command buffer: a received command is ACKed straight away if there's a free slot,
+ *    otherwise the ACK is held back until the command at the head finishes
+ *  - execution: each opcode takes a configurable amount of time, and commands that produce
+ *    a response send it when they finish
+ * and the things that matter for getting it right:
+ *  - a garbled frame, or one whose ID isn't the next one, gets a retransmit request ('tx')
+ *    and is thrown away
+ *  - moves are decoded (v3 deltas included) and followed, so qpos says where the host really
+ *    put the machine
+ *  - an abort forgets what wasn't ACKed, and the v3 state, as the protocol says
+ *  - a new baud rate goes back to the old one if it isn't confirmed within a second
+ * Faults can be injected (see emu_config_t). It's all driven off the real clock, one event at
+ * a time, in a single thread. */
+
+void emu_defaults (emu_config_t *cfg) {
+	cfg->baud = BAUDRATE;
+	cfg->max_baud = 0;
+	cfg->v3 = true;
+	cfg->depth = 16;	// BUFFER_SIZE in the firmware
+	for (int i=0; i < 256; i++) {
+		cfg->exec_us[i] = 50;
+	}
+	cfg->exec_us[MOVA] = cfg->exec_us[MOVR] = 2000;
+	cfg->exec_us[MARC] = cfg->exec_us[MHLX] = 5000;
+	cfg->exec_us[HOME] = 200000;
+	cfg->verbose = false;
+	cfg->corrupt = 0;
+	cfg->garble_above = 0;
+	cfg->abort_at = 0;
+	cfg->seed = 1;
+}
+
+// make a new pty. The name of the end the host should open goes in slave_name.
+// Returns the master fd, or -1.
+int emu_open (char *slave_name, int len) {
+	int m = posix_openpt (O_RDWR | O_NOCTTY);
+	if (m < 0 || grantpt (m) < 0 || unlockpt (m) < 0) {
+		perror ("emu_open");
+		return -1;
+	}
+	strncpy (slave_name, ptsname (m), len);
+	open (slave_name, O_RDWR | O_NOCTTY);	// hold the slave open ourselves too, so the master doesn't see hangups between host connections
+	return m;
+}
+
+typedef struct {
+	uchar op;
+	uchar id;
+	uchar len;
+	uchar data[COM_SIZE];
+	float f[4];		// a move's operands, decoded as it arrived (v3 MOVA deltas depend on what came before)
+} emu_cmd_t;
+
+static emu_config_t *cfg;
+static int mfd;
+static bool compact = false;	// speaking v3 frames
+static bool greeted = false;	// have we answered a ping yet
+static long abort_until = 0;	// when aborted, the time 'resume' gets pressed
+static int expect = -1;			// ID the next frame has to have (-1: whatever comes first)
+static int last_acked = -1;		// ID of the last command ACKed
+static compact_state_t dec;		// v3 decoder state, the mirror of the host's encoder
+static double pos[3];			// where the moves executed so far have put the machine, in mm from the working origin
+static double origin[3];		// and where that is
+static long finished = 0;		// commands executed
+static long revert_at = 0;		// when an unconfirmed baud rate change goes back (0: none pending)
+static int old_baud;
+
+static deque<pair<uchar, long> > rx;	// bytes on their way in, with the time each finishes arriving
+static long rx_free = 0;				// when the incoming line is next idle
+static uchar frame[COMPACT_MAX_FRAME + COM_SIZE];
+static int framelen = 0;
+
+static deque<pair<long, string> > tx;	// bytes on their way out, with when they've been sent
+static long tx_free = 0;
+
+static deque<emu_cmd_t> buffer;		// the firmware's command buffer
+static bool held = false;			// a command arrived while the buffer was full; its ACK is held back
+static emu_cmd_t held_cmd;
+static long exec_end = 0;			// when the command at the head of the buffer finishes
+
+static long now_us () {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static inline long byte_us () {
+	return 10000000L / cfg->baud;
+}
+
+// queue some bytes to go back to the host, paced by the line rate
+static void reply (const uchar *b, int n) {
+	long t = now_us ();
+	if (tx_free > t) t = tx_free;
+	tx_free = t + n * byte_us ();
+	tx.push_back (make_pair (tx_free, string ((const char *) b, n)));
+}
+
+static void ack (emu_cmd_t *c) {
+	last_acked = c->id;
+	uchar a[2] = {'a', c->id};
+	reply (a, 2);
+}
+
+static void respond (emu_cmd_t *c, const uchar *data, int n) {
+	uchar r[3 + 256];
+	r[0] = 'r';
+	r[1] = c->id;
+	r[2] = n;
+	memcpy (&r[3], data, n);
+	reply (r, n + 3);
+}
+
+static int exec_time (emu_cmd_t *c) {
+	if (c->op == WAIT) return ((c->data[0] << 8) | c->data[1]) * 1000;
+	return cfg->exec_us[c->op];
+}
+
+static void start_next (long t) {
+	if (!buffer.empty ()) exec_end = t + exec_time (&buffer.front ());
+}
+
+// the command at the head of the buffer has finished
+static void finish (emu_cmd_t *c) {
+	uchar zero[6] = {0, 0, 0, 0, 0, 0};
+	const float *f = c->f;
+	finished++;
+	switch (c->op) {
+		case MOVA:
+			for (int i=0; i < 3; i++) pos[i] = f[i];
+			break;
+		case MOVR:
+			for (int i=0; i < 3; i++) pos[i] += f[i];
+			break;
+		case MARC:
+		case MHLX: {
+			double r = fabs (f[0]), th = f[1] * M_PI / 180, dth = f[2] * M_PI / 180;
+			pos[0] += r * (cos (th + dth) - cos (th));
+			pos[1] += r * (sin (th + dth) - sin (th));
+			if (c->op == MHLX) pos[2] += f[3] * f[2] / 360;
+			break;
+		}
+		case HOME:
+			for (int i=0; i < 3; i++) {
+				if (c->data[0] & (1 << i)) pos[i] = origin[i] = 0;
+			}
+			break;
+		case SWOX:
+		case SWOY: {	// origin = here + offset
+			command_t x;
+			memcpy (&x.bytes[COM_DATA_START], c->data, 4);
+			int k = c->op == SWOX ? 0 : 1;
+			origin[k] += pos[k] + cmd_getfloat (&x, COM_DATA_START);
+			pos[k] = -cmd_getfloat (&x, COM_DATA_START);
+			break;
+		}
+		case CLWO:
+			for (int i=0; i < 3; i++) {
+				pos[i] += origin[i];
+				origin[i] = 0;
+			}
+			break;
+		case QPOS:
+		case QABS: {	// 16 bits an axis, in 0.01 mm
+			uchar b[6];
+			for (int i=0; i < 3; i++) {
+				int v = (int) lrint (pos[i] * 100);
+				b[2*i] = (uchar) (v >> 8);
+				b[2*i+1] = (uchar) v;
+			}
+			respond (c, b, 6);
+			break;
+		}
+		case QWOR:
+			respond (c, zero, 6);	break;
+		case QROT:
+		case QSPS:
+			respond (c, zero, 4);	break;
+		case QEND:
+			respond (c, zero, 1);	break;
+		case ECHO: {
+			int n = c->len;
+			while (n > 0 && c->data[n-1] == 0) n--;
+			respond (c, c->data, n);
+			break;
+		}
+		case SPRV: {
+			uchar v = (cfg->v3 && c->data[0] >= 3) ? 3 : 2;
+			respond (c, &v, 1);
+			compact = (v == 3);
+			compact_reset (&dec);
+			break;
+		}
+		case QBDR:
+			if (cfg->max_baud) {
+				uchar b[4] = {(uchar) (cfg->max_baud >> 24), (uchar) (cfg->max_baud >> 16), (uchar) (cfg->max_baud >> 8), (uchar) cfg->max_baud};
+				respond (c, b, 4);
+			}
+			break;
+	}
+}
+
+/* Abort: the buffer's cleared, along with any command whose ACK was being held back, so the
+ * next ID expected is the one after the last ACKed; and the v3 delta state goes back to zero. */
+static void abort_now () {
+	buffer.clear ();
+	held = false;
+	framelen = 0;
+	expect = last_acked < 0 ? -1 : (last_acked + 1) & 0xff;
+	compact_reset (&dec);
+	uchar a = 'A';
+	reply (&a, 1);
+	abort_until = now_us () + 100000;	// someone presses resume a little later
+}
+
+// a complete, valid command has arrived
+static void received (emu_cmd_t *c) {
+	if (c->op == STOP) {
+		abort_now ();
+		return;
+	}
+	if (buffer.size () < (size_t) cfg->depth) {
+		buffer.push_back (*c);
+		if (buffer.size () == 1) start_next (now_us ());
+		ack (c);
+		if (c->op == SBDR) {	// the ACK goes at the old rate, everything after at the new one
+			int rate = (c->data[0] << 24) | (c->data[1] << 16) | (c->data[2] << 8) | c->data[3];
+			if (revert_at && rate == cfg->baud) {	// the second one, at the new rate: it sticks
+				revert_at = 0;
+			} else {
+				old_baud = cfg->baud;
+				cfg->baud = rate;
+				revert_at = now_us () + 1000000;
+			}
+		}
+	} else {
+		held = true;
+		held_cmd = *c;
+	}
+}
+
+static unsigned int get_varint (const uchar **p) {
+	unsigned int v = 0;
+	for (int shift = 0; ; shift += 7) {
+		uchar b = *(*p)++;
+		v |= (unsigned int) (b & 0x7f) << shift;
+		if (!(b & 0x80)) return v;
+	}
+}
+
+static int get_zigzag (const uchar **p) {
+	unsigned int v = get_varint (p);
+	return (int) (v >> 1) ^ -(int) (v & 1);
+}
+
+// work out a move's operands, from a v3 frame (and what came before) or a 20-byte one
+static void decode (emu_cmd_t *c, const uchar *frame) {
+	for (int i=0; i < 4; i++) c->f[i] = 0;
+	if (c->op != MOVA && c->op != MOVR && c->op != MARC && c->op != MHLX) return;
+	if (!compact) {
+		command_t x;
+		memcpy (x.bytes, frame, COM_SIZE);
+		for (int i=0; i < 4; i++) c->f[i] = cmd_getfloat (&x, COM_DATA_START + 4*i);
+		return;
+	}
+	const uchar *p = c->data;
+	if (c->op == MOVA || c->op == MOVR) {
+		uchar flags = *p++;
+		int d[3];
+		for (int i=0; i < 3; i++) d[i] = (flags & (1 << i)) ? get_zigzag (&p) : 0;
+		if (flags & 8) dec.f = get_varint (&p);
+		if (c->op == MOVA) {
+			dec.x += d[0];	dec.y += d[1];	dec.z += d[2];
+			d[0] = dec.x;	d[1] = dec.y;	d[2] = dec.z;
+		}
+		for (int i=0; i < 3; i++) c->f[i] = d[i] / 100.0f;
+		c->f[3] = dec.f / 100.0f;
+		return;
+	}
+	uchar flags = c->op == MARC ? *p++ : 0;
+	c->f[0] = get_varint (&p) / 100.0f;
+	c->f[1] = get_zigzag (&p) / 100.0f;
+	c->f[2] = get_zigzag (&p) / 100.0f;
+	if (c->op == MHLX) {
+		c->f[3] = get_zigzag (&p) / 100.0f;
+	} else {
+		if (flags & 8) dec.f = get_varint (&p);
+		c->f[3] = dec.f / 100.0f;
+	}
+}
+
+// whether the frame that's just come in gets garbled on the way
+static bool garbled () {
+	if (cfg->garble_above && cfg->baud > cfg->garble_above) return true;
+	if (cfg->corrupt <= 0) return false;
+	cfg->seed = cfg->seed * 1103515245u + 12345u;
+	return (cfg->seed >> 8) % 1000000 < cfg->corrupt * 1000000;
+}
+
+static void request_retransmit () {
+	uchar t[2] = {'t', 'x'};
+	reply (t, 2);
+}
+
+static uchar xorsum (const uchar *b, int n) {
+	uchar cs = 0;
+	for (int i=0; i < n; i++) cs ^= b[i];
+	return cs;
+}
+
+// feed one byte into the frame assembler
+static void frame_byte (uchar b) {
+	if (!greeted) {	// the host pings with 1s until we say something
+		if (b == 1) {
+			uchar c = 'C';
+			reply (&c, 1);
+			greeted = true;
+			expect = -1;
+		}
+		return;
+	}
+	frame[framelen++] = b;
+	emu_cmd_t c;
+	if (compact) {
+		if (frame[0] == COMPACT_STOP) {
+			framelen = 0;
+			c.op = STOP;
+			received (&c);
+			return;
+		}
+		if (framelen < frame[0] + 1) return;
+		int n = framelen;
+		framelen = 0;
+		if (xorsum (frame, n - 1) != frame[n-1] || n < 4 || garbled ()) {
+			request_retransmit ();
+			return;
+		}
+		c.op = frame[1];
+		c.id = frame[2];
+		c.len = n - 4;
+		memset (c.data, 0, sizeof(c.data));
+		memcpy (c.data, &frame[3], c.len);
+	} else {
+		if (framelen == 1 && frame[0] == STOP) {	// takes effect as soon as its opcode's read
+			framelen = 0;
+			c.op = STOP;
+			received (&c);
+			return;
+		}
+		if (framelen < COM_SIZE) return;
+		framelen = 0;
+		if (xorsum (frame, COM_SIZE - 1) != frame[COM_SIZE-1] || garbled ()) {
+			request_retransmit ();
+			return;
+		}
+		c.op = frame[0];
+		c.id = frame[2];
+		c.len = COM_SIZE - 4;
+		memcpy (c.data, &frame[3], c.len);
+	}
+	if (expect >= 0 && c.id != expect) {	// one before it went missing
+		request_retransmit ();
+		return;
+	}
+	expect = (c.id + 1) & 0xff;
+	decode (&c, frame);
+	received (&c);
+}
+
+void emu_run (int master, emu_config_t *config) {
+	cfg = config;
+	mfd = master;
+	fcntl (mfd, F_SETFL, O_NONBLOCK);
+
+	while (true) {
+		long t = now_us ();
+
+		// a new rate that wasn't confirmed in time
+		if (revert_at && t >= revert_at) {
+			revert_at = 0;
+			cfg->baud = old_baud;
+		}
+
+		// resume pressed after an abort
+		if (abort_until && t >= abort_until) {
+			abort_until = 0;
+			uchar c = 'C';
+			reply (&c, 1);
+			rx.clear ();
+			framelen = 0;
+		}
+		// commands finishing
+		while (!buffer.empty () && t >= exec_end) {
+			long end = exec_end;
+			finish (&buffer.front ());
+			buffer.pop_front ();
+			if (held) {
+				held = false;
+				buffer.push_back (held_cmd);
+				ack (&held_cmd);
+			}
+			start_next (end);
+			if (cfg->abort_at && finished == cfg->abort_at) abort_now ();
+		}
+		// bytes that have finished arriving, unless we're holding a command back (the
+		// firmware stops reading until it has somewhere to put it)
+		while (!held && !rx.empty () && rx.front ().second <= t) {
+			uchar b = rx.front ().first;
+			rx.pop_front ();
+			if (!abort_until) frame_byte (b);
+		}
+		// bytes that have finished leaving
+		while (!tx.empty () && tx.front ().first <= t) {
+			string &s = tx.front ().second;
+			if (write (mfd, s.data (), s.size ()) < 0 && errno != EAGAIN) {
+				perror ("emu_run: write");
+			}
+			tx.pop_front ();
+		}
+
+		// sleep until the next thing happens or the host sends something
+		long next = -1;
+		if (!buffer.empty ()) next = exec_end;
+		if (!held && !rx.empty () && (next < 0 || rx.front ().second < next)) next = rx.front ().second;
+		if (!tx.empty () && (next < 0 || tx.front ().first < next)) next = tx.front ().first;
+		if (abort_until && (next < 0 || abort_until < next)) next = abort_until;
+		if (revert_at && (next < 0 || revert_at < next)) next = revert_at;
+		struct timespec ts, *timeout = NULL;
+		if (next >= 0) {
+			long d = next - now_us ();
+			if (d < 0) d = 0;
+			ts.tv_sec = d / 1000000;
+			ts.tv_nsec = (d % 1000000) * 1000;
+			timeout = &ts;
+		}
+		struct pollfd pfd = {mfd, POLLIN, 0};
+#ifdef __linux__
+		int ready = ppoll (&pfd, 1, timeout, NULL);
+#else
+		int ready = poll (&pfd, 1, timeout ? (int) (ts.tv_sec * 1000 + (ts.tv_nsec + 999999) / 1000000) : -1);
+#endif
+		if (ready > 0 && (pfd.revents & POLLIN)) {
+			uchar buf[4096];
+			int n = read (mfd, buf, sizeof(buf));
+			long now = now_us ();
+			if (rx_free < now) rx_free = now;
+			for (int i=0; i < n; i++) {
+				rx_free += byte_us ();
+				rx.push_back (make_pair (buf[i], rx_free));
+			}
+			if (cfg->verbose && n > 0) fprintf (stderr, "emu: %d bytes in\n", n);
+		} else if (pfd.revents & POLLHUP) {
+			usleep (10000);	// nobody has the other end open (yet)
+		}
+	}
+}
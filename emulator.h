@@ -0,0 +1,26 @@
+/* emulator.h - a stand-in for the router firmware on a pseudo-terminal, for benchmarking */
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include "compact.h"
+
+typedef struct {
+	int baud;			// line rate to model (bytes take 10 bit times each way)
+	int max_baud;		// answer to qbdr; 0 to ignore qbdr like older firmware
+	bool v3;			// accept sprv 3 and switch to compact frames
+	int depth;			// number of commands the firmware can buffer
+	int exec_us[256];	// how long each opcode takes to execute (WAIT uses its argument instead)
+	bool verbose;
+
+	// faults to inject, to exercise the host's error handling
+	double corrupt;		// fraction of incoming frames that arrive garbled
+	int garble_above;	// every frame arrives garbled at rates above this (0: none do)
+	int abort_at;		// abort (as if an endstop was hit) when this many commands have finished (0: never)
+	unsigned int seed;	// for picking which frames get garbled
+} emu_config_t;
+
+void emu_defaults (emu_config_t *cfg);
+int emu_open (char *slave_name, int len);
+void emu_run (int master, emu_config_t *cfg);
+
+#endif
@@ -0,0 +1,72 @@
+#include "estimate.h"
+#include <cmath>
+using namespace std;
+
+void est_init (estimator_t *e) {
+	pos_init (&e->pos);
+	e->feed = 0;
+	e->t = 0;
+	e->unknown = 0;
+	e->times = NULL;
+	e->out.clear ();
+}
+
+// time to cover len going from speed a to speed b, with the speed changing steadily
+static double ramp_time (double len, double a, double b) {
+	return len > 0 && a + b > 0 ? 2.0 * len / (a + b) : 0;
+}
+
+double est_command (estimator_t *e, const ircmd_t *c) {
+	const float *f = c->a.f;
+	double dt = 0;
+	switch (c->op) {
+		case MOVA:
+		case MOVR: {
+			double d2 = 0;
+			for (int i=0; i < 3; i++) {
+				if (c->op == MOVA && !e->pos.known[i]) {
+					d2 = -1;
+					break;
+				}
+				double d = c->op == MOVA ? f[i] - e->pos.w[i] : f[i];
+				d2 += d * d;
+			}
+			if (d2 < 0) e->unknown++;
+			else dt = ramp_time (sqrt (d2), e->feed, f[3]);
+			break;
+		}
+		case MARC:
+			dt = ramp_time (fabs (f[0] * f[2]) * M_PI / 180, e->feed, f[3]);
+			break;
+		case MHLX:
+			dt = ramp_time (hypot (f[0] * f[2] * M_PI / 180, f[3] * f[2] / 360), e->feed, e->feed);
+			break;
+		case WAIT:
+			dt = c->a.i[0] / 1000.0;
+			break;
+		case HOME:
+			dt = EST_HOME_TIME;
+			break;
+		case EDGX:
+		case EDGY:
+			dt = EST_EDGEFIND_TIME;
+			break;
+		case EFMX:
+		case EFMY:
+		case EF2X:
+		case EF2Y:
+			dt = 2 * EST_EDGEFIND_TIME;	// two edgefinds, and the move between
+			break;
+	}
+	if (dt < EST_CMD_TIME) dt = EST_CMD_TIME;
+	pos_track (&e->pos, c);
+	if (c->op == MOVA || c->op == MOVR || c->op == MARC) e->feed = f[3];
+	e->t += dt;
+	return dt;
+}
+
+void est_push (estimator_t *e, const ircmd_t *c) {
+	est_command (e, c);
+	if (e->times != NULL) e->times->push_back ((float) e->t);
+	e->out.push_back (*c);
+}
@@ -0,0 +1,27 @@
+/* estimate.h - how long a job takes, worked out from its commands in one pass. Each opcode
+ * is timed the way the firmware carries it out (see new_protocol): a move ramps the feedrate
+ * linearly from the last F to its own, so it takes 2 len / (v0 + v1); MARC and MHLX go by
+ * their length along the arc (a helix at the feedrate there already is); WAIT takes what it
+ * says; and homing and edgefinding, which depend on where the machine is, cost what config.h
+ * says they do. Nothing is timed below EST_CMD_TIME, which is about what it takes the link
+ * and the firmware to get through a command at all. */
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include "planner.h"
+#include <vector>
+
+typedef struct {
+	postrack_t pos;
+	float feed;					// the last F
+	double t;					// seconds, for everything so far
+	unsigned long unknown;		// MOVAs from somewhere not known, which took no time
+	std::vector<float> *times;	// if set, the time each command is done by goes on the end
+	std::vector<ircmd_t> out;	// what's ready to go on (the caller empties it)
+} estimator_t;
+
+void est_init (estimator_t *);
+void est_push (estimator_t *, const ircmd_t *);
+double est_command (estimator_t *, const ircmd_t *);	// just time c (and follow it), returning how long it takes
+
+#endif
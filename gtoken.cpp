@@ -0,0 +1,199 @@
+#include "gtoken.h"
+#include <cstring>
+#include <cstdlib>
+#include <cfloat>
+using namespace std;
+
+#ifdef GTOKEN_SIMD
+// bit i set if base[i] is a newline, for the 64 bytes at base (or fewer, at the end of the text)
+static uint64_t newline_mask (const char *base, const char *e) {
+	if (e - base >= 64) {
+		const __m128i nl = _mm_set1_epi8 ('\n');
+		uint64_t m0 = _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) base), nl));
+		uint64_t m1 = _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (base + 16)), nl));
+		uint64_t m2 = _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (base + 32)), nl));
+		uint64_t m3 = _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (base + 48)), nl));
+		return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+	}
+	uint64_t m = 0;
+	for (int i=0; base + i < e; i++) {
+		if (base[i] == '\n') m |= 1ull << i;
+	}
+	return m;
+}
+
+void ls_init (linescan_t *ls, const char *s, const char *e) {
+	ls->base = s;
+	ls->e = e;
+	ls->mask = s < e ? newline_mask (s, e) : 0;
+}
+
+// move on to the next block with a newline in it (and return that newline)
+const char *ls_refill (linescan_t *ls) {
+	while (ls->mask == 0) {
+		ls->base += 64;
+		if (ls->base >= ls->e) {
+			ls->base = ls->e;
+			return ls->e;
+		}
+		ls->mask = newline_mask (ls->base, ls->e);
+	}
+	int i = __builtin_ctzll (ls->mask);
+	ls->mask &= ls->mask - 1;
+	return ls->base + i;
+}
+#else
+void ls_init (linescan_t *ls, const char *s, const char *e) {
+	ls->base = s;
+	ls->e = e;
+	ls->mask = 0;
+}
+
+const char *ls_refill (linescan_t *ls) {
+	const char *nl = (const char *) memchr (ls->base, '\n', ls->e - ls->base);
+	if (nl == NULL) {
+		ls->base = ls->e;
+		return ls->e;
+	}
+	ls->base = nl + 1;
+	return nl;
+}
+#endif
+
+static inline bool is_space (char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');	// the C locale's isspace
+}
+
+static inline bool is_digit (char c) {
+	return (unsigned char) (c - '0') < 10;
+}
+
+// hand the odd cases to the C library, on a null terminated copy
+#define SLOW_MAX 256	// as long as a line can be
+static const char *slow_copy (const char *s, const char *e, char *buf) {
+	int len = e - s < SLOW_MAX ? e - s : SLOW_MAX;
+	memcpy (buf, s, len);
+	buf[len] = 0;
+	return buf;
+}
+
+static float slow_float (const char *s, const char *e, const char **end) {
+	char buf[SLOW_MAX + 1], *bend;
+	float v = strtof (slow_copy (s, e, buf), &bend);
+	*end = s + (bend - buf);
+	return v;
+}
+
+static long slow_long (const char *s, const char *e, const char **end) {
+	char buf[SLOW_MAX + 1], *bend;
+	long v = strtol (slow_copy (s, e, buf), &bend, 10);
+	*end = s + (bend - buf);
+	return v;
+}
+
+static const float pow10f[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+static const double pow10d[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* The digits are gathered into an integer mantissa m and a power of ten. When both fit in a
+ * float exactly (m <= 2^24, power <= 10) a single float multiply or divide gives the correctly
+ * rounded answer. Failing that, the same in double (m <= 2^53, power <= 22) gives the correctly
+ * rounded double, and rounding that to float is still right unless it landed exactly halfway
+ * between two floats, which is left to strtof. */
+float scan_float (const char *s, const char *e, const char **end) {
+	const char *p = s;
+	while (p < e && is_space (*p)) p++;
+	bool neg = false;
+	if (p < e && (*p == '+' || *p == '-')) {
+		neg = *p == '-';
+		p++;
+	}
+	// leading zeros don't count towards the 19 digits a uint64_t can hold
+	const char *q = p;
+	while (q < e && *q == '0') q++;
+	bool any = q > p;
+	uint64_t m = 0;
+	int digits = 0, exp10 = 0;
+	const char *d0 = q;
+	for (; q < e && is_digit (*q); q++) {
+		m = m * 10 + (*q - '0');
+	}
+	digits = q - d0;
+	any |= digits > 0;
+	if (q < e && (*q == 'x' || *q == 'X') && q == p + 1 && *p == '0') return slow_float (s, e, end);	// hex
+	if (q < e && *q == '.') {
+		q++;
+		const char *f0 = q;
+		if (m == 0) {
+			while (q < e && *q == '0') q++;
+		}
+		const char *f1 = q;
+		for (; q < e && is_digit (*q); q++) {
+			m = m * 10 + (*q - '0');
+		}
+		any |= q > f0;
+		digits += q - f1;
+		exp10 = -(int) (q - f0);
+	}
+	if (!any) {
+		if (p < e && (*p == 'i' || *p == 'I' || *p == 'n' || *p == 'N')) return slow_float (s, e, end);	// inf, nan
+		*end = s;
+		return 0;
+	}
+	if (digits > 19) return slow_float (s, e, end);	// m overflowed; let strtof deal with it
+	if (q < e && (*q == 'e' || *q == 'E')) {
+		const char *r = q + 1;
+		bool eneg = false;
+		if (r < e && (*r == '+' || *r == '-')) {
+			eneg = *r == '-';
+			r++;
+		}
+		if (r < e && is_digit (*r)) {
+			int x = 0;
+			for (; r < e && is_digit (*r); r++) {
+				if (x < 10000) x = x * 10 + (*r - '0');
+			}
+			exp10 += eneg ? -x : x;
+			q = r;
+		}
+	}
+	*end = q;
+
+	float v;
+	if (m == 0) {
+		v = 0;
+	} else if (m <= (1u << 24) && exp10 >= -10 && exp10 <= 10) {
+		v = exp10 < 0 ? (float) (int32_t) m / pow10f[-exp10] : (float) (int32_t) m * pow10f[exp10];	// m fits in an int here, which converts faster
+	} else if (m <= (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+		double d = exp10 < 0 ? (double) m / pow10d[-exp10] : (double) m * pow10d[exp10];
+		uint64_t bits;
+		memcpy (&bits, &d, sizeof(bits));
+		if ((bits & 0x1fffffff) == 0x10000000 || d < FLT_MIN || d > FLT_MAX) return slow_float (s, e, end);
+		v = (float) d;
+	} else {
+		return slow_float (s, e, end);
+	}
+	return neg ? -v : v;
+}
+
+long scan_long (const char *s, const char *e, const char **end) {
+	const char *p = s;
+	while (p < e && is_space (*p)) p++;
+	bool neg = false;
+	if (p < e && (*p == '+' || *p == '-')) {
+		neg = *p == '-';
+		p++;
+	}
+	const char *q = p;
+	long v = 0;
+	for (; q < e && is_digit (*q); q++) {
+		if (q - p == 18) return slow_long (s, e, end);	// might overflow
+		v = v * 10 + (*q - '0');
+	}
+	if (q == p) {
+		*end = s;
+		return 0;
+	}
+	*end = q;
+	return neg ? -v : v;
+}
@@ -0,0 +1,45 @@
+/* gtoken.h - the low level scanning the G-code parser is built on: finding line ends and
+ * reading numbers, without the C library's locale handling or the need for a terminating null */
+#ifndef GTOKEN_H
+#define GTOKEN_H
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define GTOKEN_SIMD 1
+#endif
+
+/* Finds the newlines in a block of text, 64 bytes at a time with SSE2 (one compare per 16
+ * bytes, turned into a bit per byte), and then one at a time out of the bitmask. Without
+ * SSE2 it falls back to memchr. */
+typedef struct {
+	const char *base;	// start of the current block
+	const char *e;		// end of the text
+	uint64_t mask;		// newlines in the current block that haven't been returned yet
+} linescan_t;
+
+void ls_init (linescan_t *, const char *s, const char *e);
+const char *ls_refill (linescan_t *);
+
+// the next newline, or e if there are no more
+static inline const char *ls_next (linescan_t *ls) {
+#ifdef GTOKEN_SIMD
+	if (ls->mask == 0) return ls_refill (ls);
+	int i = __builtin_ctzll (ls->mask);
+	ls->mask &= ls->mask - 1;
+	return ls->base + i;
+#else
+	return ls_refill (ls);
+#endif
+}
+
+/* Number parsing with strtof/strtol semantics (leading whitespace, optional sign; if there's
+ * no number, 0 is returned and *end is s), except that the decimal point is always '.' and
+ * the text only needs to be valid up to e. Floats are correctly rounded. The common short
+ * forms are handled directly; anything unusual (hex, inf/nan, very long mantissas, huge
+ * exponents) goes through the C library on a bounded copy. */
+float scan_float (const char *s, const char *e, const char **end);
+long scan_long (const char *s, const char *e, const char **end);
+
+#endif
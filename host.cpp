@@ -1,6 +1,11 @@
 #include "host.h"
+#include "profile.h"
+#include "dryrun.h"
+#include "resume.h"
 #include <sys/time.h>
 #include <errno.h>
+#include <cstring>
+#include <unistd.h>
 #include <iostream>
 using namespace std;
 
@@ -16,6 +21,8 @@ void homeaxis_callback (Component *c, int b, int s);
 void load_callback (Component *c, int b, int s);
 void connect_callback (Component *c, int b, int s);
 void run_callback (Component *c, int b, int s);
+void resume_callback (Component *c, int b, int s);
+void runfrom_callback (Component *c, int b, int s);
 void estop_callback (Component *c, int b, int s);
 void gcode_entry_callback (Textfield *tf);
 
@@ -49,6 +56,12 @@ Container topbar (Rect (0, 0, WIN_XS, 40));
 Textfield gcode_input (Rect (80, 460, WIN_XS-90, 25), "", gcode_entry_callback);
 Label gcode_input_label (Rect (10, 460, 70, 25), "Gcode:");
 
+Label eta (Rect (WIN_XS - 320, 380, 300, 25), "");
+
+Button resumebutton (Rect (WIN_XS - 320, 415, 90, 20), "Resume", resume_callback);
+Button runfrom (Rect (WIN_XS - 220, 415, 90, 20), "Run from", runfrom_callback);
+Textfield from_line (Rect (WIN_XS - 120, 415, 100, 20), "(line)");
+
 Label xpos (Rect (0, 0, 120, 25), "X: 0.00", true);
 Label ypos (Rect (0, 30, 120, 25), "Y: 0.00", true);
 Label zpos (Rect (0, 60, 120, 25), "Z: 0.00", true);
@@ -115,6 +128,10 @@ void setup_gui () {
 	root.add (&gcode);
 	root.add (&move_amounts);
 	root.add (&feedrates);
+	root.add (&eta);
+	root.add (&resumebutton);
+	root.add (&runfrom);
+	root.add (&from_line);
 
 }
 
@@ -128,6 +145,10 @@ void do_layout () {
 	gcode_input.setBounds (Rect (80, 460, WIN_XS-90, 25));
 	topbar.setBounds (Rect (0, 0, WIN_XS, 40));
 	feedrates.setBounds (Rect (WIN_XS - 320, 340, 300, 25));
+	eta.setBounds (Rect (WIN_XS - 320, 380, 300, 25));
+	resumebutton.setBounds (Rect (WIN_XS - 320, 415, 90, 20));
+	runfrom.setBounds (Rect (WIN_XS - 220, 415, 90, 20));
+	from_line.setBounds (Rect (WIN_XS - 120, 415, 100, 20));
 }
 
 // this is called whenever one of the axis motion buttons is pressed. The button
@@ -180,46 +201,106 @@ void homeaxis_callback (Component *c, int b, int s) {
 // parse and run the gcode command typed in the textfield
 void gcode_entry_callback (Textfield *tf) {
 	console_append (tf->text);
-	vector<command_t> cmd = parse_gcode ((char *) (tf->text.c_str()), NULL);
+	jobir_t ir;
+	parse_gcode ((char *) (tf->text.c_str()), NULL, &ir);
 	tf->clear();
 	if (err) {
 		console_append ("Malformed G-code; not sending.");
-	} else {
-		iocore_run_manualv (cmd);
+		return;
+	}
+	vector<command_t> cmd;
+	ircursor_t cur;
+	ircmd_t ic;
+	ir_seek (&ir, &cur, 0);
+	while (ir_next (&ir, &cur, &ic)) {
+		cmd.push_back (cmd_encode (&ic, cmd.size ()));
 	}
+	iocore_run_manualv (cmd);
 }
 
-// try to load and parse the gcode file specified by the filename textfield
-void load_callback (Component *c, int b, int s) {
-	if (s == GLUT_UP) return;
-
+// show the start of a job in the gcode view. Huge files would take forever to copy into
+// the Textscroller, so only the first GCODE_VIEW_LINES lines go in.
+static void show_gcode (const char *s, size_t len) {
 	gcode.clear();
-	FILE *gc = fopen (file_name.text.c_str(), "r");
-	if (gc == NULL) {
-		console_append ("Could not open file.");
-		return;
+	const char *end = s + len;
+	for (int n=0; s < end; n++) {
+		if (n == GCODE_VIEW_LINES) {
+			gcode.append_line ("...");
+			break;
+		}
+		const char *lbp = (const char *) memchr (s, '\n', end - s);
+		if (lbp == NULL) lbp = end;
+		gcode.append_line (string (s, lbp - s));
+		s = lbp + 1;
 	}
-	fseek (gc, 0, SEEK_END);
-	long len = ftell (gc);
-	rewind (gc);
-
-	char *fstr = (char *) (malloc (len));
-	fread (fstr, len, 1, gc);
-	fclose (gc);
+}
 
-	vector <command_t> cmd = parse_gcode (fstr, &gcode);
+/* The ETA comes from the time estimates in the job's cache (see estimate.h), mapped in again
+ * here for the GUI. A job that's streamed in the first time it's loaded has its cache built
+ * alongside, with the same pipeline, so once that's done its estimates line up with what's
+ * being sent too. */
+static rjob_t *eta_rj = NULL;
+static string eta_path;		// the job's source, while its cache may still turn up
+static string job_path;		// the job's source
+static bool run_waiting = false;	// Run was pressed before the job's cache was done
+
+static void eta_load (const char *path) {
+	job_path = path;
+	run_waiting = false;
+	rjob_close (eta_rj);
+	eta_rj = rjob_open (path);
+	eta_path = eta_rj == NULL ? path : "";
+}
 
-	if (err) {
-		console_append ("Malformed GCODE.");
-		return;
+/* How long the job has to go, going by how much of it the router has ACKed, and by how its
+ * time so far compares with the estimate (see profile.h). */
+static void eta_update () {
+	if (eta_rj == NULL && !eta_path.empty () && !rjob_building ()) {
+		eta_rj = rjob_open (eta_path.c_str ());
+		eta_path.clear ();
 	}
-
-	for (int i=0; i < cmd.size(); i++) {
-		cmd_println (cmd[i]);
+	char buf[64], t[32];
+	if (eta_rj == NULL || eta_rj->count == 0) {
+		buf[0] = 0;
+	} else if (!iocore_running ()) {
+		snprintf (buf, sizeof(buf), "Job: about %s", plan_format_time (eta_rj->time[eta_rj->count - 1], t, sizeof(t)));
+	} else {
+		// ACKed commands may still be waiting in the router's buffer
+		long n = min ((long) eta_rj->count, (long) acked) - BUFFER_SIZE;
+		double total = eta_rj->time[eta_rj->count - 1], done = n > 0 ? eta_rj->time[n - 1] : 0;
+		snprintf (buf, sizeof(buf), "ETA: %s (%.0f%% done)", plan_format_time ((total - done) * prof_scale (), t, sizeof(t)),
+				total > 0 ? 100 * done / total : 0);
 	}
+	if (eta.text != buf) eta.setText (buf);
+}
 
-	iocore_load (cmd);
+/* Load the gcode file specified by the filename textfield. If it's been loaded before and
+ * hasn't changed since, the commands come straight from the job cache. Otherwise it's parsed
+ * in the background as it's sent (so this returns right away, and errors turn up in the
+ * console as they're found), and the cache is built for next time. */
+void load_callback (Component *c, int b, int s) {
+	if (s == GLUT_UP) return;
 
+	const char *path = file_name.text.c_str();
+	gstream_t *gs = gstream_open (path);
+	if (gs == NULL) {
+		log_info ("Could not open file.");
+		return;
+	}
+	show_gcode (gs->data, gs->len);
+	rjob_t *rj = rjob_open (path);
+	if (rj != NULL) {
+		gstream_close (gs);
+		log_info ("Loaded %lu commands from the job cache.", (unsigned long) rj->count);
+		log_jobstats (&rj->hdr->stats);
+		iocore_load (job_new_cached (rj));
+		eta_load (path);
+		return;
+	}
+	gstream_start (gs);
+	iocore_load (job_new_stream (gs));
+	rjob_build_async (path);
+	eta_load (path);
 }
 
 static const string constrings[3] = {"Connect", "Connecting...", "Disconnect"};
@@ -241,24 +322,151 @@ void connect_callback (Component *c, int b, int s) {
 	connect.setText (constrings[connection]);
 }
 
+/* Before a job's run, it's checked against the machine's travel (see dryrun.h), starting from
+ * where the machine's been sent. What's checked is the job as it'll be sent, from its cache;
+ * one that's streamed in has its cache built alongside, so Run waits for that (see idle).
+ * When it's started part way, that's the preamble and then the job from 'start'. If it can't
+ * be checked at all, it isn't run. */
+static bool check_travel (size_t start = 0, const vector<ircmd_t> *pre = NULL) {
+	eta_update ();	// opens the cache, if it's turned up
+	if (!SOFT_LIMITS || iocore_running () || job_path.empty ()) return true;
+	postrack_t here;
+	iocore_machine (&here);
+	static dryrun_t d;	// its batch is a bit big for the stack
+	dry_init (&d, &here);
+	for (size_t i=0; pre != NULL && i < pre->size(); i++) dry_push (&d, &(*pre)[i]);
+	if (eta_rj == NULL) {
+		log_error ("Not running: the job couldn't be checked against the machine's travel.");
+		return false;
+	}
+	for (size_t i=start; i < eta_rj->count; i++) dry_push (&d, &eta_rj->cmd[i]);
+	dry_finish (&d);
+	dry_report (&d);
+	if (d.violations > 0) {
+		log_error ("Not running: %lu moves go outside the machine's travel.", d.violations);
+		return false;
+	}
+	return true;
+}
+
 // try to start the job running when the run button is pressed
 void run_callback (Component *c, int b, int s){
 	if (s == GLUT_UP) return;
+	eta_update ();
+	if (SOFT_LIMITS && !iocore_running () && eta_rj == NULL && !eta_path.empty ()) {
+		if (!run_waiting) log_info ("The job will start once it's been checked against the machine's travel.");
+		run_waiting = true;
+		return;
+	}
+	if (!check_travel ()) return;
 	iocore_run_auto ();
 }
 
+/* Start the job part way through, at command 'start' of its cache: the commands before it
+ * are gone through to work out what state they'd have left the machine in, and a preamble
+ * that gets it there goes first (see resume.h). The job's sent from its cache from then on,
+ * since a stream can't start part way. 'fresh' is for when the router may not still have the
+ * working origin from earlier in the job. */
+static void run_part (long start, bool fresh) {
+	eta_update ();
+	if (iocore_running ()) return;
+	if (eta_rj == NULL) {
+		log_info (!eta_path.empty () ? "Still going through the job; try again in a moment." :
+				"A job can only be started part way once it's been loaded in full.");
+		return;
+	}
+	if (start < 0 || (size_t) start >= eta_rj->count) {
+		log_info ("There's nothing in the job to run from there.");
+		return;
+	}
+	jobstate_t st;
+	state_init (&st);
+	for (long i=0; i < start; i++) state_track (&st, &eta_rj->cmd[i]);
+	const ircmd_t *next = &eta_rj->cmd[start];
+	vector<ircmd_t> pre;
+	if (!resume_preamble (&st, next, &pre)) return;
+	if (fresh && st.origin_moved) {
+		log_warn ("The job moves the working origin before line %d; it's taken to be where the router has it now.", next->line);
+	}
+	if (!check_travel (start, &pre)) return;
+	rjob_t *rj = rjob_open (job_path.c_str ());
+	if (rj == NULL) {
+		log_info ("The job's cache has gone; load it again.");
+		return;
+	}
+	jobir_t ir;
+	ir_clear (&ir);
+	for (size_t i=0; i < pre.size(); i++) ir_push (&ir, &pre[i]);
+	log_info ("Running from line %d (command %ld of %lu).", next->line, start, (unsigned long) eta_rj->count);
+	iocore_load (job_new_cached (rj));
+	iocore_run_from (start, job_new (&ir));
+}
+
+// carry on from where the job was stopped
+void resume_callback (Component *c, int b, int s) {
+	if (s == GLUT_UP) return;
+	int cp = checkpoint;
+	if (cp < 0) {
+		log_info ("There's no stopped job to resume.");
+		return;
+	}
+	run_part (cp, false);
+}
+
+// start from the line in the from_line textfield
+void runfrom_callback (Component *c, int b, int s) {
+	if (s == GLUT_UP) return;
+	int line = atoi (from_line.text.c_str ());
+	if (line <= 0) {
+		log_info ("Please enter the line to run from.");
+		return;
+	}
+	eta_update ();
+	long start = eta_rj != NULL ? resume_find_line (eta_rj->cmd, eta_rj->count, line) : 0;
+	if (eta_rj != NULL && start < 0) {
+		log_info ("There's nothing in the job from line %d on.", line);
+		return;
+	}
+	if (start == 0) {	// that's the whole job
+		run_callback (c, b, s);
+		return;
+	}
+	run_part (start, true);
+}
+
 void estop_callback (Component *c, int b, int s){
-// TODO: implement this
+	if (s == GLUT_UP) return;
+	run_waiting = false;
+	iocore_estop ();
 }
 
-// make a message appear on the console (the one in the GUI and also on the terminal)
-void console_append (string str) {
-	cout << str << endl;
-	console.scrollpos = max (0, (int) (console.lines.size() + 1 - console.display_lines));	// autoscroll to the end
-	console.append_line (str);
+/* The console in the GUI is one of the logger's sinks. Lines arrive on the logger thread, but
+ * the Textscroller belongs to the GUI thread, so they wait in console_inbox until idle() picks them up. */
+static pthread_mutex_t console_mut = PTHREAD_MUTEX_INITIALIZER;
+static vector<string> console_inbox;
+
+static void console_sink (int level, int cat, long time_us, const char *line) {
+	pthread_mutex_lock (&console_mut);
+	console_inbox.push_back (line);
+	pthread_mutex_unlock (&console_mut);
 	pthread_cond_signal (&redisplay_cond);	// magic
 }
 
+// move whatever the logger has produced into the console. Called on the GUI thread.
+static bool console_take () {
+	static vector<string> lines;
+	pthread_mutex_lock (&console_mut);
+	lines.swap (console_inbox);
+	pthread_mutex_unlock (&console_mut);
+	if (lines.empty ()) return false;
+	for (size_t i=0; i < lines.size(); i++) {
+		console.scrollpos = max (0, (int) (console.lines.size() + 1 - console.display_lines));	// autoscroll to the end
+		console.append_line (lines[i]);
+	}
+	lines.clear ();
+	return true;
+}
+
 bool splashing = true;
 Image splash (fopen("splash.8888", "r"));
 
@@ -334,10 +542,44 @@ void idle () {
 	timeout.tv_sec = curr_time.tv_sec;
 	timeout.tv_nsec = (curr_time.tv_usec + 50000) * 1000;
 	int x = pthread_cond_timedwait (&redisplay_cond, &redisplay_mut, &timeout);
-	if (x == ETIMEDOUT) {
-	} else {
+	if (console_take () || x != ETIMEDOUT) {
 		glutPostRedisplay();
 	}
+	// the I/O thread changes the connection state; keep the button in step with it
+	static int shown = DISCONNECTED;
+	if (connection != shown) {
+		shown = connection;
+		connect.setText (constrings[connection]);
+	}
+	// the profile is added up as the job goes, and written out once it's over
+	static bool was_running = false;
+	bool now_running = iocore_running ();
+	if (PROFILE_JOBS) {
+		prof_take ();
+		if (was_running && !now_running && prof_pending ()) prof_write (job_path.c_str ());
+	}
+	was_running = now_running;
+	// say where a stopped job got to in the source, which is still good after a restart
+	static int shown_cp = -1;
+	int cp = checkpoint;
+	if (cp != shown_cp) {
+		shown_cp = cp;
+		if (cp >= 0 && eta_rj != NULL && (size_t) cp < eta_rj->count) {
+			log_info ("The job stopped around line %d: Resume carries on from there (or Run from that line later).", eta_rj->cmd[cp].line);
+		}
+	}
+	// a Run that was waiting on the job's cache goes ahead once it's there
+	if (run_waiting && !rjob_building ()) {
+		run_waiting = false;
+		eta_update ();
+		if (check_travel ()) iocore_run_auto ();
+	}
+	static long next_eta = 0;
+	long now = curr_time.tv_sec * 1000L + curr_time.tv_usec / 1000;
+	if (now >= next_eta) {
+		next_eta = now + ETA_INTERVAL;
+		eta_update ();
+	}
 }
 
 int main (int argc, char** argv) {
@@ -347,6 +589,9 @@ int main (int argc, char** argv) {
 	setup_gui();
 	pthread_cond_init (&redisplay_cond, NULL);
 	pthread_mutex_init (&redisplay_mut, NULL);
+	log_add_sink (log_stdout_sink, LOGC_ALL, LOG_MIN_LEVEL);
+	log_add_sink (console_sink, LOGC_ALL & ~(1u << LOGC_TRACE), LOG_MIN_LEVEL);
+	log_init ();
 	iocore_init ();
 
 	glutInit (&argc, argv);
@@ -3,9 +3,10 @@
 
 #include "iocore.h"
 #include "gui.h"
+#include "logger.h"
+#include "pipeline.h"
 
 extern Button connect;
-void console_append (string str);
 
 
 #endif
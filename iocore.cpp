@@ -1,74 +1,246 @@
 #include "iocore.h"
 #include "host.h"
+#include "schema.h"
+#include "profile.h"
+#include <cstring>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <climits>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 using namespace std;
 
 static int spfd = -1;	// file descriptor number for the serial port 
-static vector<command_t> cmd;	// list of commands to send to the router when iocore_run_auto is called
-static deque<command_t> sent;	// a list of recently sent commands. This is useful for interpreting and
-								// formatting the responses received.
-static deque<command_t> manual_cmd;	// manual mode commands to be sent
+static const char *port_name = SERIAL_PORT_NAME;
+static int wakefd[2] = {-1, -1};	// written to by other threads to wake the I/O thread up (eventfd or self-pipe)
+static job_t *job = NULL;		// the job to send to the router when iocore_run_auto is called (I/O thread only)
+static atomic<job_t *> next_job (NULL);	// a newly loaded job, waiting for the I/O thread to pick it up
+static job_t *preamble = NULL;	// commands to send before the job, when it's started part way (I/O thread only)
+static ircursor_t pre_cursor;
+static atomic<job_t *> next_preamble (NULL);	// and the same, waiting to go with the next REQ_RUN
 
-static uchar response_buffer[256];	// a place to store responses from the router (for commands like get position)
-static int response_len = 0;		// number of bytes in the response
-static int response_id = 0;			// id of the command to which this is a response. 
+/* Other threads (the GUI) never touch the I/O thread's state directly. They hand it requests
+ * and manual commands through lock-free queues, and read back what it publishes in atomics
+ * ('connection', 'running', 'progress', 'acked', 'checkpoint' and
+ * 'io_idle'). */
+#define REQ_CONNECT 0
+#define REQ_DISCONNECT 1
+#define REQ_LOAD 2		// there's something in next_job
+#define REQ_RUN 3
+#define REQ_ESTOP 4
+#define REQ_MANUAL 5	// more commands were put on manual_cmd
 
-static bool running = false;		// whether or not we're running (in auto mode)
-int connection = DISCONNECTED;		// status of the connection
+typedef struct {
+	int type;
+	int start;		// REQ_RUN: which command of the job to start from
+} ioreq_t;
+
+static Spscqueue<ioreq_t, 64> requests;
+static Spscqueue<command_t, MANUAL_QUEUE_SIZE> manual_cmd;	// manual mode commands to be sent
+static unsigned int req_posted = 0;				// requests posted so far (only touched by the posting thread)
+static atomic<unsigned int> req_done (0);		// requests the I/O thread has finished with
+static atomic<bool> io_idle (false);			// published by the I/O thread along with req_done
+
+/* Commands are sent with a sliding window: up to TX_WINDOW of them may be waiting for their
+ * ACK at any one time. Every frame that goes out is stamped with the next sequence number, and
+ * a copy is kept in the 'window' table, indexed by the low byte of that number (which is all the
+ * ACK gives us back). Entries are left in place after they're ACKed, so the table also serves as
+ * the history used to interpret responses. */
+typedef struct {
+	command_t c;
+	uchar wire[TXQ_MAX_FRAME];	// exactly what went out, so a retransmit repeats it byte for byte
+	uchar wirelen;
+	bool outstanding;	// sent but not yet ACKed
+	unsigned int txi;	// where its latest copy went in the output queue (txq.head at the time)
+	long sent_us;		// when it was queued, for measuring ACK latency
+	int job_pos;		// which command of the job it is (-1 for anything that isn't part of it)
+	ircmd_t ic;			// and for one that is, the command, and for the profile (profile.h):
+	int stall_us;		// how long it waited on the loader
+	bool waited;		// whether it waited for room in the window
+} txslot_t;
+
+static txslot_t window[256];
+static unsigned short next_seq = 0;	// sequence number for the next frame to go out
+static unsigned short oldest = 0;	// sequence number of the oldest frame that may still be outstanding
+static int inflight = 0;			// number of outstanding frames
+static int tx_skip = 0;				// retransmit requests still to come for frames that followed a bad one
+
+iocore_stats_t iostats;
+void (*iocore_ack_hook) (unsigned short seq, long latency_us) = NULL;
+
+static ringbuf_t rxring;	// bytes from the router waiting to be parsed
+static rx_parser_t rxp;
+static txqueue_t txq;		// frames waiting to be written to the router
+
+/* Link setup. We connect at BAUDRATE speaking the 20-byte frames (v2), then:
+ *  - offer the firmware v3 frames with 'sprv',
+ *  - ask it for the fastest rate it can do with 'qbdr', and
+ *  - step up to the fastest rate that passes an echo test, using 'sbdr'.
+ * The same rate change sequence is used to drop to a slower rate if too many frames need
+ * retransmitting. While any of this is going on, job and manual commands are held back. */
+#define LINK_READY 0	// carrying commands
+#define LINK_SPRV 1		// waiting for the answer to sprv
+#define LINK_QBDR 2		// waiting for the firmware's fastest rate
+#define LINK_DRAIN 3	// waiting for everything in flight to be ACKed before changing rate
+#define LINK_SBDR 4		// waiting for the ACK of sbdr, after which we both switch
+#define LINK_ECHO 5		// trying out the new rate with echo commands
+#define LINK_CONFIRM 6	// waiting for the ACK of the second sbdr, which makes the new rate stick
+#define LINK_SETTLE 7	// the new rate didn't work; waiting for the firmware to go back to the old one
+
+#define LINK_TIMEOUT 500	// ms to wait for an answer during link setup
+#define BAUD_REVERT_TIME 1000	// ms the firmware waits for a confirming sbdr before reverting
+#define ECHO_TEST_COUNT 4		// echo commands sent to try out a new rate
+#define BAUD_ERROR_SAMPLE 256	// frames sent between checks of the error rate
+
+static int linkstate = LINK_READY;
+static unsigned short link_seq;		// sequence number of the command we're waiting on
+static long link_deadline;			// in ms on the monotonic clock
+static int protover = 2;
+static compact_state_t enc;			// v3 encoder state
+
+static const int baud_ladder[] = {1000000, 500000, 250000, 230400, 115200, 57600, 38400, 19200, 9600, 0};
+static int baud = BAUDRATE;		// current rate
+static int try_baud;			// rate being switched to
+static int fw_max_baud;			// fastest the firmware says it can go
+static int echo_good;			// echo responses that came back intact
+static unsigned long err_sample_sent, err_sample_errs;	// for the error rate since the last check
+static unsigned long link_errs;	// retransmit requests and junk bytes
+
+static atomic<bool> running (false);	// whether or not we're running (in auto mode)
+static bool aborted = false;		// the router's aborted, and is ignoring us until its resume button is pressed
+atomic<int> connection (DISCONNECTED);	// status of the connection
 static int pos = 0;					// current position in the list of auto commands
+static ircursor_t cursor;			// and the same, for reading a JOB_COMMANDS job
+atomic<int> progress (0);			// copy of pos for other threads to look at
+atomic<int> acked (0);				// commands of the running job the router has ACKed (they're in its buffer, or done)
+atomic<int> checkpoint (-1);		// where the job can carry on from, after it was stopped part way (-1: it wasn't)
+static int run_start = 0;			// the command the job was started from
+
+/* Where everything sent so far takes the machine, for checking a job against its travel
+ * before it's run (dryrun.h). Only the I/O thread changes it; the lock is for other threads
+ * taking a copy. */
+static postrack_t machine;
+static pthread_mutex_t machine_lock = PTHREAD_MUTEX_INITIALIZER;
 
-pthread_mutex_t iomutex;
 pthread_t iothread;		// the IO runs in a separate thread from the GUI to allow responsivity in both.
 
 void iocore_init () {
-	pthread_mutex_init (&iomutex, NULL);
+	pos_init (&machine);
+#ifdef __linux__
+	wakefd[0] = wakefd[1] = eventfd (0, EFD_NONBLOCK);
+#else
+	pipe (wakefd);
+	fcntl (wakefd[0], F_SETFL, O_NONBLOCK);
+	fcntl (wakefd[1], F_SETFL, O_NONBLOCK);
+#endif
 	pthread_create (&iothread, NULL, iocore_mainloop, NULL);
 }
 
-// this will be called (presumably) from the GUI thread; the modified value 
-// will be noticed in iocore_mainloop and the connecting procedure will be started.
+// use a different serial port from the next connect on
+void iocore_set_port (const char *name) {
+	port_name = name;
+}
+
+// kick the I/O thread out of its poll() so it notices whatever we just changed.
+void iocore_wake () {
+#ifdef __linux__
+	uint64_t one = 1;
+	write (wakefd[1], &one, sizeof(one));
+#else
+	char one = 1;
+	write (wakefd[1], &one, 1);
+#endif
+}
+
+// swallow pending wakeups (called by the I/O thread once it's awake)
+static void drain_wake () {
+	uint64_t junk;
+	while (read (wakefd[0], &junk, sizeof(junk)) > 0);
+}
+
+// hand a request to the I/O thread and wake it up
+static bool post (int type, int start = 0) {
+	ioreq_t r = {type, start};
+	if (!requests.push (r)) {
+		log_info ("I/O thread isn't keeping up; request dropped.");
+		return false;
+	}
+	req_posted++;
+	iocore_wake ();
+	return true;
+}
+
+// this will be called (presumably) from the GUI thread; the I/O thread will
+// notice the request and start the connecting procedure.
 void iocore_connect () {
 	if (connection == DISCONNECTED) {
-		connection = PENDING;
+		post (REQ_CONNECT);
 	}
 }
 
-// disconnect from the router. Won't do it if we're currently running.
+// disconnect from the router. Won't do it if we're currently running. The port itself
+// is closed by the I/O thread, since it may be in the middle of polling it.
 void iocore_disconnect () {
 	if (connection == CONNECTED) {
 		if (!running) {
-			connection = DISCONNECTED;
-			serialport_close (spfd);
+			post (REQ_DISCONNECT);
 		} else {
-			console_append ("Can't disconnect while running.");
+			log_info ("Can't disconnect while running.");
 		}
 	} else {
-		console_append ("Already disconnected.");
+		log_info ("Already disconnected.");
 	}
 }
 
-// load a new job.
-void iocore_load (vector<command_t> c) {
-	if (!running) {
-		cmd = c;
-		pos = 0;
+/* load a new job, taking over the caller's reference to it. It's published with a swap on
+ * next_job and picked up from there by the I/O thread, so nothing is copied and the job the
+ * I/O thread is using is never touched from here. If two loads happen before the I/O thread
+ * gets round to them, the later one wins. */
+void iocore_load (job_t *j) {
+	if (running) {
+		log_info ("Can't load a job while one is running.");
+		job_unref (j);
+		return;
 	}
+	if (j->kind == JOB_STREAM) j->stream->notify = iocore_wake;
+	job_unref (next_job.exchange (j, memory_order_acq_rel));
+	post (REQ_LOAD);
 }
 
 // run the currently loaded job. Check to verify that we're connected, not
-// running, and there is a loaded job.
+// running, and there is a loaded job (that last check happens on the I/O thread).
 void iocore_run_auto () {
+	iocore_run_from (0, NULL);
+}
+
+// the same, starting from command 'start' of the job, with the commands in 'pre' (if it isn't
+// NULL) sent first. Takes the reference to 'pre'.
+void iocore_run_from (int start, job_t *pre) {
 	if (connection != CONNECTED) {
-		console_append ("Must connect to router first.");
+		log_info ("Must connect to router first.");
+		job_unref (pre);
 		return;
 	}
-	if (cmd.empty()) {
-		console_append ("No commands loaded.");
+	if (running) {
+		job_unref (pre);
 		return;
 	}
-	if (!running) {
-		pos = 0;
-		running = true;
+	job_unref (next_preamble.exchange (pre, memory_order_acq_rel));
+	post (REQ_RUN, start);
+}
+
+// emergency stop: stop feeding the job and have the I/O thread send a STOP right away,
+// ahead of anything else that's queued.
+void iocore_estop () {
+	if (connection != CONNECTED) {
+		log_info ("Not connected.");
+		return;
 	}
+	post (REQ_ESTOP);
 }
 
 /* The iocore_run_manual methods are used to run just a single command
@@ -78,245 +250,771 @@ void iocore_run_auto () {
  * in the textfield */
 bool iocore_run_manualv (vector<command_t> c) {
 	if (running) {
-		console_append ("Can't run manual commands while job is running");
+		log_info ("Can't run manual commands while job is running");
 		return false;
 	}
 	if (connection == CONNECTED) {
-	//	pthread_mutex_lock (&iomutex);
-		for (int i=0; i < c.size(); i++) {
-			manual_cmd.push_back (c[i]);
+		if (manual_cmd.space () < c.size ()) {
+			log_info ("Too many manual commands queued up; try again in a moment.");
+			return false;
 		}
-	//	pthread_mutex_unlock (&iomutex);
+		for (size_t i=0; i < c.size(); i++) {
+			manual_cmd.push (c[i]);
+		}
+		post (REQ_MANUAL);
 		return true;
 	} else {
-		console_append ("Must connect to the router first!");
+		log_info ("Must connect to the router first!");
 	}
 	return false;
 }
 
 bool iocore_run_manual (command_t c) {
-	printf ("iocore was asked to run the command: \n");
-	cmd_println (c);
-	if (running) {
-		console_append ("Can't run manual commands while job is running");
-		return false;
+	log_printf (LOG_DEBUG, LOGC_TRACE, "iocore was asked to run the command: %s", log_bytes (c.bytes, COM_SIZE));
+	return iocore_run_manualv (vector<command_t> (1, c));
+}
+
+// put a frame on the output queue. It actually goes out the next time the I/O loop flushes.
+static void queue_frame (uchar *bytes, int len) {
+	if (!txq_push (&txq, bytes, len)) {
+		log_info ("Output queue overflow; dropping frame");
+		return;
 	}
-	if (connection == CONNECTED) {
-		pthread_mutex_lock (&iomutex);
-		manual_cmd.push_back (c);
-		pthread_mutex_unlock (&iomutex);
-		return true;
-	} else {
-		console_append ("Must connect to the router first!");
+	if (txq.bytes > iostats.max_queued) iostats.max_queued = txq.bytes;
+}
+
+// write out as much of the output queue as the port will take right now
+static void flush_output () {
+	int n = txq_flush (&txq, spfd);
+	if (n > 0) {
+		iostats.writes++;
+		iostats.bytes_out += n;
 	}
-	return false;
 }
 
-/* This takes care of actually sending a command to the router. */ 
-void send_command (command_t c) {
-	if (CONSOLE_SEND) console_append (string ("Sending command: " + cmd_getstring (c)));
+int iocore_queued_bytes () {
+	return txq.bytes;
+}
+
+// whether a job is running. Safe to call from any thread.
+bool iocore_running () {
+	return running;
+}
+
+// true when we're connected and have nothing at all to do. Safe to call from any thread:
+// it's only true once the I/O thread has dealt with every request we've posted.
+bool iocore_idle () {
+	return req_done.load (memory_order_acquire) == req_posted && io_idle.load (memory_order_relaxed);
+}
+
 
-	serialport_write (spfd, &c.bytes, COM_SIZE);
-	sent.push_front (c);
-	if (sent.size() > BUFFER_SIZE) {
-		sent.pop_back ();
+// put c into whichever wire format we're speaking. Returns the length of the frame.
+static int encode (command_t *c, uchar *out) {
+	if (protover >= 3) {
+		return compact_encode (&enc, c, out);
 	}
+	memcpy (out, c->bytes, COM_SIZE);
+	return COM_SIZE;
 }
 
-/* Here's the main I/O loop. First we check our connection state. If it is disconnected,
- * we wait for 1/4 second and go around again. If someone has set our state to PENDING
- * by calling iocore_connect, then we'll attempt to open the serial port, and do the 
- * opening handshake. If we're connected, we'll go and try to read from the serial port
- * and do the appropriate thing with what we get.
-*/
+static long now_us () {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
 
-/* The actual communications protocol is implemented by a simple finite state machine.
- * See the 'protocol' file for more info on how this works */
+static long now_ms () {
+	return now_us () / 1000;
+}
 
-static int state = IDLE;
-static int substate = 0;
+/* This takes care of actually sending a command to the router. The command (which already
+ * carries the next sequence number as its ID) is entered into the window table until it's
+ * ACKed. job_pos is which command of the job it is, or -1. */
+static void send_frame (command_t c, int job_pos) {
+	log_printf (LOG_DEBUG, LOGC_SEND, "Sending command: %s", log_bytes (c.bytes, COM_SIZE));
 
-void *iocore_mainloop (void *arg) {	// the odd paramter profile is mandated by pthread
-	char inp;
-	int n;	// will store how many bytes off the serial port are waiting to be processed
+	txslot_t *slot = &window[next_seq & 0xff];
+	slot->c = c;
+	slot->wirelen = encode (&c, slot->wire);
+	slot->txi = txq.head;
+	queue_frame (slot->wire, slot->wirelen);
+	slot->outstanding = true;
+	slot->sent_us = iocore_ack_hook || PROFILE_JOBS ? now_us () : 0;
+	slot->job_pos = job_pos;
+	next_seq++;
+	inflight++;
+	iostats.sent++;
+}
 
-	while (true) {
-		if (connection == DISCONNECTED) {	// if we're not connected, check back in 1/4 second.
-			usleep (1000 * 250);
-			continue;
-		}
-		if (connection == PENDING) {		// someone has told us to connect.
-			spfd = serialport_init (SERIAL_PORT_NAME, BAUDRATE);
-			if (spfd == -1) {
-				console_append ("Couldn't open serial port.");
-				connection = DISCONNECTED;
-				connect.setText ("Connect");
+// follow what a command does to the machine's position
+static void track (const ircmd_t *ic) {
+	pthread_mutex_lock (&machine_lock);
+	pos_track (&machine, ic);
+	pthread_mutex_unlock (&machine_lock);
+}
+
+// the machine stopped somewhere in the middle of a move
+static void lose_position () {
+	ircmd_t stop = {STOP, -1, {{0, 0, 0, 0}}};
+	track (&stop);
+}
+
+void iocore_machine (postrack_t *p) {
+	pthread_mutex_lock (&machine_lock);
+	*p = machine;
+	pthread_mutex_unlock (&machine_lock);
+}
+
+void send_command (command_t c) {
+	cmd_setid (&c, next_seq);
+	send_frame (c, -1);
+	ircmd_t ic;
+	if (cmd_decode (&c, &ic)) track (&ic);
+}
+
+static long starved_us = 0;		// when the loader last came up empty with room in the window (0: it hasn't)
+static bool window_full = false;	// the window filled up since the last job command went out
+
+// a job's commands are only made into frames here, as they go out
+static void send_ircmd (const ircmd_t *ic) {
+	txslot_t *slot = &window[next_seq & 0xff];
+	send_frame (cmd_encode (ic, next_seq), pos);
+	track (ic);
+	slot->ic = *ic;
+	slot->stall_us = starved_us != 0 ? (int) (slot->sent_us - starved_us) : 0;
+	slot->waited = window_full;
+	starved_us = 0;
+	window_full = false;
+}
+
+// top up the window from the job (or the manual queue if no job is running)
+static void fill_window () {
+	if (linkstate != LINK_READY) return;
+	while (inflight < TX_WINDOW) {
+		if (running && preamble != NULL) {
+			ircmd_t ic;
+			if (ir_next (&preamble->ir, &pre_cursor, &ic)) {
+				send_frame (cmd_encode (&ic, next_seq), -1);
+				track (&ic);
 				continue;
 			}
-			sleep (1);	// give the Arduino a little time to wake up
-
-			while (serialport_read (spfd, &inp) <= 0) {	// while the read either fails or there's no data coming in
-				// every second, send a byte with value 1 to the router until it responds to us.
-				char x = 1;
-				if (CONSOLE_PING) console_append (string ("ping"));
-				serialport_write (spfd, &x, 1);
-				sleep (1);
+			job_unref (preamble);
+			preamble = NULL;
+		}
+		if (running) {
+			if (job->kind == JOB_STREAM) {
+				ircmd_t ic;
+				if (!gstream_pop (job->stream, &ic)) {	// the loader will wake us when it has more
+					if (PROFILE_JOBS && starved_us == 0 && !gstream_finished (job->stream)) starved_us = now_us ();
+					break;
+				}
+				send_ircmd (&ic);
+			} else if (job->kind == JOB_CACHED) {
+				if ((size_t) pos >= job->rjob->count) break;
+				send_ircmd (&job->rjob->cmd[pos]);
+			} else {
+				ircmd_t ic;
+				if (!ir_next (&job->ir, &cursor, &ic)) break;
+				send_ircmd (&ic);
 			}
-			n = 1;
-			connect.setText ("Disconnect");
-			connection = CONNECTED;
+			pos++;
+			progress.store (pos, memory_order_relaxed);
+		} else {
+			command_t c;
+			if (!manual_cmd.pop (&c)) break;
+			send_command (c);
+		}
+	}
+	if (running && inflight == TX_WINDOW) window_full = true;
+}
 
-			printf ("Connected\n");
+// once everything in the job has gone out and been ACKed, the job is over
+static void check_done () {
+	if (!running || inflight != 0) return;
+	if (job->kind == JOB_STREAM) {
+		gstream_t *gs = job->stream;
+		if (!gstream_finished (gs)) return;
+		if (gs->state == STREAM_FAILED) {
+			log_error ("Job stopped at line %d: %s", gs->err_line, gs->err_msg);
 		}
-		if (!running && !manual_cmd.empty()) {	// if there are manual commands to run and we're not running a job, run the first one
-			send_command (manual_cmd[0]);
-			manual_cmd.pop_front();
+	} else if ((size_t) pos < job_count (job)) {
+		return;
+	}
+	log_printf (LOG_DEBUG, LOGC_TRACE, "Commands exhausted. Running = false");
+	running = false;
+	checkpoint = -1;
+	iocore_print_stats ();
+}
+
+// mark the command with the given (low byte of its) ID as received by the router
+static void acknowledge (uchar id) {
+	iostats.acks++;
+	iostats.depth_sum += inflight;
+	if (inflight == TX_WINDOW) iostats.full_acks++;
+
+	txslot_t *slot = &window[id];
+	if (!slot->outstanding) {
+		log_printf (LOG_DEBUG, LOGC_TRACE, "ACK for command %d, which isn't outstanding", id);
+		return;
+	}
+	slot->outstanding = false;
+	inflight--;
+	long now = iocore_ack_hook || PROFILE_JOBS ? now_us () : 0;
+	if (running && slot->job_pos >= 0) {
+		if (slot->job_pos >= acked.load (memory_order_relaxed)) acked.store (slot->job_pos + 1, memory_order_relaxed);
+		if (PROFILE_JOBS) {
+			profrec_t r = {slot->ic, slot->job_pos, slot->stall_us, slot->waited, slot->sent_us, now};
+			prof_record (&r);
 		}
-		// if we're in auto mode and we haven't run a command yet, get the first one going. This needs to be 
-		// special-cased because in general commands are sent in response to an acknowledgement that the previous
-		// command has been received by the router. You have to knock over the first domino.
-		if (running && pos == 0) {
-			printf ("Sending first command in auto mode\n");
-			send_command (cmd[0]);
-			pos++;
+	}
+	if (iocore_ack_hook) {
+		unsigned short seq = oldest + (uchar) (id - oldest);	// the full sequence number this ACK refers to
+		iocore_ack_hook (seq, now - slot->sent_us);
+	}
+	while (oldest != next_seq && !window[oldest & 0xff].outstanding) {	// slide the bottom of the window up
+		oldest++;
+	}
+}
+
+/* The job's been stopped part way. What the router has ACKed may still have been waiting in
+ * its buffer, and the command before those may have been under way, so it can carry on from
+ * the first of those (going over a few moves again, but never missing one out). */
+static void stop_job () {
+	running = false;
+	job_unref (preamble);
+	preamble = NULL;
+	checkpoint = max (run_start, (int) acked - BUFFER_SIZE - 1);
+	log_info ("Job stopped; it can carry on from command %d.", (int) checkpoint);
+}
+
+// forget about everything in flight; the router throws its buffer away when it aborts.
+static void clear_window () {
+	for (int i=0; i < 256; i++) {
+		window[i].outstanding = false;
+	}
+	inflight = 0;
+	oldest = next_seq;
+	tx_skip = 0;
+}
+
+// send a link setup command and note that we're waiting on it
+static void link_send (command_t c, int newlink) {
+	linkstate = newlink;
+	link_seq = next_seq;
+	link_deadline = now_ms () + LINK_TIMEOUT;
+	send_command (c);
+}
+
+// fastest rate on the ladder that's strictly between 'above' and 'below' and that both ends
+// can manage, or 0 if there isn't one
+static int next_baud (int below, int above) {
+	for (int i=0; baud_ladder[i]; i++) {
+		int r = baud_ladder[i];
+		if (r < below && r > above && r <= BAUD_MAX && r <= fw_max_baud) return r;
+	}
+	return 0;
+}
+
+// ask the firmware to switch to 'rate' (or give up and carry on at the current rate if it's 0)
+static void try_rate (int rate) {
+	if (rate == 0) {
+		linkstate = LINK_READY;
+		log_info ("Running at %d baud.", baud);
+		return;
+	}
+	try_baud = rate;
+	link_send (cmd_initl (SBDR, 0, rate), LINK_SBDR);
+}
+
+static void start_baud () {
+	if (BAUD_MAX <= BAUDRATE) {
+		linkstate = LINK_READY;
+		return;
+	}
+	link_send (cmd_init (QBDR, 0), LINK_QBDR);
+}
+
+// offer the firmware the compact format. Called right after connecting, with nothing in flight.
+static void start_negotiation () {
+	protover = 2;
+	baud = fw_max_baud = BAUDRATE;
+	err_sample_sent = err_sample_errs = link_errs = 0;
+	if (PROTOCOL_VERSION < 3) {
+		start_baud ();
+		return;
+	}
+	link_send (cmd_initb (SPRV, 0, PROTOCOL_VERSION), LINK_SPRV);
+}
+
+// the firmware has answered the sprv (ver = the version it switched to, or 0 if it didn't answer)
+static void finish_negotiation (int ver) {
+	if (ver >= 3) {
+		protover = 3;
+		compact_reset (&enc);
+		log_info ("Using compact (v3) frames.");
+	} else {
+		protover = 2;
+		clear_window ();	// an old firmware may never ACK the sprv
+		log_info ("Firmware doesn't support v3 frames; using 20-byte frames.");
+	}
+	start_baud ();
+}
+
+// the bytes we put in echo test command i
+static void echo_pattern (int i, char *p) {
+	for (int k=0; k < COM_STRLEN_MAX; k++) {
+		p[k] = (char) (((i * 37 + k * 11) & 0xff) | 1);	// no zeros, since trailing zeros aren't echoed
+	}
+}
+
+// the new rate didn't work out. Go back to the old one, and once the firmware has too, try the next one down.
+static void rate_failed () {
+	log_warn ("%d baud didn't work.", try_baud);
+	serialport_setbaud (spfd, baud);
+	linkstate = LINK_SETTLE;
+	link_deadline = now_ms () + BAUD_REVERT_TIME + LINK_TIMEOUT;
+}
+
+// the ACK for command 'id' just came in
+static void link_ack (uchar id) {
+	if (id != (link_seq & 0xff)) return;
+	if (linkstate == LINK_SBDR) {
+		// the firmware has switched; everything ahead of the sbdr went out at the old rate (nothing went after it)
+		serialport_setbaud (spfd, try_baud);
+		serialport_discard_input (spfd);
+		echo_good = 0;
+		linkstate = LINK_ECHO;
+		link_seq = next_seq;
+		link_deadline = now_ms () + LINK_TIMEOUT;
+		for (int i=0; i < ECHO_TEST_COUNT; i++) {
+			char p[COM_STRLEN_MAX];
+			echo_pattern (i, p);
+			send_command (cmd_init_str (ECHO, 0, p, p + COM_STRLEN_MAX));
 		}
+	} else if (linkstate == LINK_CONFIRM) {
+		baud = try_baud;
+		try_rate (0);
+	}
+}
 
+// a response came in during link setup. Returns true if it was ours.
+static bool link_response (rx_event_t *ev) {
+	if (linkstate == LINK_SPRV && ev->id == (link_seq & 0xff)) {
+		finish_negotiation (ev->len > 0 ? ev->data[0] : 0);
+		return true;
+	}
+	if (linkstate == LINK_QBDR && ev->id == (link_seq & 0xff)) {
+		fw_max_baud = ev->len >= 4 ? (ev->data[0] << 24) | (ev->data[1] << 16) | (ev->data[2] << 8) | ev->data[3] : BAUDRATE;
+		try_rate (next_baud (INT_MAX, baud));
+		return true;
+	}
+	if (linkstate == LINK_ECHO) {
+		int i = (uchar) (ev->id - link_seq);
+		if (i >= ECHO_TEST_COUNT) return false;
+		char p[COM_STRLEN_MAX];
+		echo_pattern (i, p);
+		if (ev->len != COM_STRLEN_MAX || memcmp (p, ev->data, COM_STRLEN_MAX) != 0) {
+			rate_failed ();
+		} else if (++echo_good == ECHO_TEST_COUNT) {
+			link_send (cmd_initl (SBDR, 0, try_baud), LINK_CONFIRM);
+		}
+		return true;
+	}
+	return false;
+}
 
-		if (n > 0) {	// if we have serial data to process (the actual read takes place at the end of this loop)
-			printf ("Recv: %c (%d)\n", inp, inp);
-			
-			if (state == IDLE) {
-				switch (inp) {
-					case 'a':
-						state = ACK;	substate = 1;	break;
-					case 't':
-						state = RETRANSMIT;	substate = 1;	break;
-					case 'r':
-						state = RESPONSE; substate = 1; break;
-					case 'A':
-						state = ABORT;	
-						console_append ("Endstop or maximum coordinate hit during move! Press resume button");	break;
-					default:
-						console_append ("Unexpected byte received!");
-						printf ("Unexpected byte received: %c (%d)\n", inp, inp);
-				}
-			} else if (state == ACK) {
-				// if we're here, it means inp is the ID number of the command that got ACKed, and so the ACK is complete.
-				if (CONSOLE_ACK) {
-					char s[10];
-					sprintf (s, "ACK %d", inp);
-					console_append (string (s));
-				}
-				state = IDLE;
-				substate = 0;
-				// the ACK is our cue to send the next command
-				if (running) {	
-				   	if (pos < cmd.size()) {
-						send_command (cmd[pos++]);
-					} else {
-						printf ("COmmands exhaiusted. Running = false\n");
-						running = false;
-					}
-				} else {
-					if (!manual_cmd.empty()) {
-						send_command (manual_cmd[0]);
-						manual_cmd.pop_front();
-					}
-				}
+// something garbled came in, or the router asked for a retransmit
+static void link_error () {
+	link_errs++;
+	if (linkstate == LINK_ECHO || linkstate == LINK_CONFIRM) {
+		rate_failed ();
+	}
+}
 
-			} else if (state == RESPONSE) {
-				/* Responses are structured as follows:
-				 * byte 0: 'r'
-				 * byte 1: ID number of the command to which this is a response
-				 * byte 2: number of bytes in the data for the response
-				 * [data]
-				 *
-				 * The 'substate' variable is used to keep track of where we are.
-				*/
-				if (substate == 1) {
-					response_id = inp;
-					memset (response_buffer, 0, 256);
-				} else if (substate == 2) {
-					response_len = inp;
-				} else {
-					response_buffer[substate - 3] = inp;
-				}
-				substate++;
-				if (substate - 3 == response_len) {	// we've received as many bytes as the router told us it wanted to send
-					state = IDLE;
-					substate = 0;
-					print_response();
+// called every time around the I/O loop; moves link setup along when it's waiting on time
+// or on the window draining. Returns how long poll() may sleep for (-1 = indefinitely).
+static int link_service () {
+	if (linkstate == LINK_READY) {
+		// keep an eye on the error rate, and drop to a slower rate if it gets too high
+		if (iostats.sent - err_sample_sent >= BAUD_ERROR_SAMPLE) {
+			float rate = (link_errs - err_sample_errs) / (float) (iostats.sent - err_sample_sent);
+			err_sample_sent = iostats.sent;
+			err_sample_errs = link_errs;
+			if (rate > BAUD_ERROR_MAX && baud > BAUDRATE) {
+				log_warn ("Error rate %.1f%% at %d baud; slowing down.", rate * 100, baud);
+				try_baud = next_baud (baud, 0);
+				if (try_baud < BAUDRATE) try_baud = BAUDRATE;
+				linkstate = LINK_DRAIN;
+			}
+		}
+		if (linkstate == LINK_READY) return -1;
+	}
+	if (linkstate == LINK_DRAIN) {
+		if (inflight == 0 && txq_empty (&txq)) {
+			link_send (cmd_initl (SBDR, 0, try_baud), LINK_SBDR);
+		}
+		return -1;
+	}
+	long left = link_deadline - now_ms ();
+	if (left > 0) return (int) left;
+
+	// timed out
+	switch (linkstate) {
+		case LINK_SPRV:
+			finish_negotiation (0);
+			break;
+		case LINK_QBDR:
+			clear_window ();
+			log_info ("Firmware doesn't report its fastest baud rate.");
+			try_rate (0);
+			break;
+		case LINK_SBDR:
+			clear_window ();
+			try_rate (0);
+			break;
+		case LINK_ECHO:
+		case LINK_CONFIRM:
+			rate_failed ();
+			break;
+		case LINK_SETTLE:
+			// both ends are back at the old rate now
+			serialport_discard_input (spfd);
+			rx_init (&rxp, &rxring);
+			clear_window ();
+			try_rate (next_baud (try_baud, baud < try_baud ? baud : 0));
+			break;
+	}
+	return link_service ();	// anything we just started has a fresh deadline
+}
+
+/* The actual communications protocol is parsed by rx_next (see rxparse.cpp and the 'protocol'
+ * file); here we just act on what it tells us. */
+static void handle_event (rx_event_t *ev) {
+	switch (ev->type) {
+		case RX_ACK:
+			log_printf (LOG_DEBUG, LOGC_ACK, "ACK %d", ev->id);
+			acknowledge (ev->id);
+			if (linkstate != LINK_READY) link_ack (ev->id);
+			break;
+		case RX_RETRANSMIT:
+			if (tx_skip > 0) {	// the fallout from one we've already dealt with
+				tx_skip--;
+				break;
+			}
+			link_error ();
+			retransmit ();
+			break;
+		case RX_RESPONSE:
+			if (linkstate != LINK_READY && link_response (ev)) break;
+			print_response (ev);
+			break;
+		case RX_ABORT:
+			// it's thrown away everything it hadn't ACKed, and its v3 state (see new_protocol):
+			// pick up again from the first command it didn't take
+			next_seq = oldest;
+			clear_window ();
+			compact_reset (&enc);
+			if (running) stop_job ();
+			lose_position ();
+			aborted = true;
+			log_info ("Endstop or maximum coordinate hit during move! Press resume button");
+			break;
+		case RX_CLEAR:
+			aborted = false;
+			log_info ("Router cleared the abort.");
+			break;
+		case RX_JUNK:
+			link_error ();
+			log_warn ("Unexpected byte received: %c (%d)", ev->byte, ev->byte);
+			break;
+	}
+}
+
+// open the serial port and do the opening handshake: ping the router once a second until it
+// says something back. Returns false (and leaves us DISCONNECTED) if it didn't work out.
+static bool do_connect () {
+	spfd = serialport_init (port_name, BAUDRATE);
+	if (spfd == -1) {
+		log_info ("Couldn't open serial port.");
+		connection = DISCONNECTED;
+		return false;
+	}
+	sleep (1);	// give the Arduino a little time to wake up
+
+	struct pollfd pfd[2] = {{spfd, POLLIN, 0}, {wakefd[0], POLLIN, 0}};
+	long next_ping = 0;
+	while (true) {
+		// every second, send a byte with value 1 to the router until it responds to us. Only ever
+		// one a second, though: a ping that crosses the router's reply would look like the start of a frame.
+		if (now_ms () >= next_ping) {
+			char x = 1;
+			log_printf (LOG_DEBUG, LOGC_PING, "ping");
+			serialport_write (spfd, &x, 1);
+			next_ping = now_ms () + 1000;
+		}
+		if (poll (pfd, 2, next_ping - now_ms ()) > 0) {
+			if (pfd[0].revents & POLLIN) break;
+			drain_wake ();	// requests wait until we're connected (there's no calling off a connect)
+		}
+	}
+	usleep (1000 * 50);
+	serialport_discard_input (spfd);	// whatever the router said back to the pings isn't part of the protocol
+	aborted = false;
+	pthread_mutex_lock (&machine_lock);	// opening the port resets the Arduino: it's forgotten where it was
+	pos_init (&machine);
+	pthread_mutex_unlock (&machine_lock);
+	connection = CONNECTED;
+	log_info ("Connected");
+	return true;
+}
+
+// the STOP jumps the queue, and doesn't wait for room in the window. It doesn't take an ID;
+// the window is rewound once the router says it's aborted.
+static void send_estop () {
+	txq_discard (&txq);
+	command_t c = cmd_init (STOP, next_seq);
+	uchar wire[TXQ_MAX_FRAME];
+	queue_frame (wire, encode (&c, wire));
+	log_info ("ESTOP sent");
+}
+
+// apply one request from another thread. Called on the I/O thread only.
+static void handle_request (ioreq_t *r) {
+	switch (r->type) {
+		case REQ_CONNECT:
+			if (connection == DISCONNECTED) connection = PENDING;
+			break;
+		case REQ_DISCONNECT:
+			if (!running) connection = DISCONNECTED;
+			break;
+		case REQ_LOAD: {
+			job_t *j = next_job.exchange (NULL, memory_order_acq_rel);
+			if (j == NULL) break;	// an earlier request already picked it up
+			if (running) {
+				log_info ("Can't load a job while one is running.");
+				job_unref (j);
+				break;
+			}
+			job_unref (job);
+			job = j;
+			pos = 0;
+			progress = 0;
+			acked = 0;
+			checkpoint = -1;
+			break;
+		}
+		case REQ_RUN: {
+			job_t *pre = next_preamble.exchange (NULL, memory_order_acq_rel);
+			if (connection != CONNECTED || running) {
+				job_unref (pre);
+				break;
+			}
+			if (aborted) {
+				log_info ("The router's still stopped: press its resume button first.");
+				job_unref (pre);
+				break;
+			}
+			if (r->start > 0 && (job == NULL || job->kind == JOB_STREAM || (size_t) r->start >= job_count (job))) {
+				log_info ("Can't start the job from command %d.", r->start);
+				job_unref (pre);
+				break;
+			}
+			if (job != NULL && job->kind == JOB_STREAM) {
+				gstream_t *gs = job->stream;
+				if (gs->state == STREAM_FAILED) {
+					log_error ("Malformed G-code in line %d; not running.", gs->err_line);
+					job_unref (pre);
+					break;
 				}
-			} else if (state == RETRANSMIT) {
-				if (inp == 'x') {
-					retransmit();
-				} else {
-					console_append ("Expecting 'x' after 't' for retransmit\n");
+				if (pos > 0) {	// it's been sent before (or partly): parse it again
+					gstream_start (gs);
 				}
-				state = IDLE;
-				substate = 0;
-			} else if (state == ABORT) {
-				// the only way to get out of the ABORT state is for the router to send a 'C' indicating things are clear
-				if (inp == 'C') {
-					state = IDLE;
+				if (gs->state == STREAM_DONE && gs->parsed == 0) {
+					log_info ("No commands loaded.");
+					job_unref (pre);
+					break;
 				}
+			} else if (job == NULL || job_count (job) == 0) {
+				log_info ("No commands loaded.");
+				job_unref (pre);
+				break;
+			}
+			pos = run_start = r->start;
+			progress = pos;
+			acked = pos;
+			checkpoint = -1;
+			starved_us = 0;
+			window_full = false;
+			if (job->kind == JOB_COMMANDS) ir_seek (&job->ir, &cursor, pos);
+			preamble = pre;
+			if (pre != NULL) ir_seek (&pre->ir, &pre_cursor, 0);
+			memset (&iostats, 0, sizeof(iostats));
+			running = true;
+			break;
+		}
+		case REQ_ESTOP:
+			if (connection != CONNECTED) break;
+			if (running) stop_job ();
+			send_estop ();
+			lose_position ();
+			aborted = true;		// the router aborts on a STOP, too
+			break;
+		case REQ_MANUAL:	// nothing to do; fill_window will find them
+			break;
+	}
+}
+
+/* Here's the main I/O loop. The thread spends nearly all of its time blocked in poll(),
+ * waiting either for bytes from the router or for another thread to poke the wake fd
+ * (iocore_connect, iocore_run_*, iocore_estop, ...). Whenever it wakes up it deals with
+ * any change in the connection state, sends whatever the window allows, and then feeds
+ * everything waiting on the serial port through the protocol state machine.
+*/
+void *iocore_mainloop (void *arg) {	// the odd paramter profile is mandated by pthread
+	struct pollfd pfd[2];
+
+	unsigned int done = 0;
+
+	while (true) {
+		ioreq_t r;
+		while (requests.pop (&r)) {
+			handle_request (&r);
+			done++;
+		}
+		if (connection == DISCONNECTED && spfd != -1) {	// iocore_disconnect asked us to hang up
+			serialport_close (spfd);
+			spfd = -1;
+		}
+		if (connection == PENDING) {		// someone has told us to connect.
+			if (do_connect ()) {
+				rx_init (&rxp, &rxring);
+				txq_init (&txq);
+				clear_window ();
+				start_negotiation ();
+			}
+			continue;
+		}
+		int timeout = -1;
+		if (connection == CONNECTED) {
+			timeout = link_service ();
+			if (rxp.state != ABORT && !aborted) {	// the router ignores us until it's cleared an abort
+				fill_window ();
 			}
+			check_done ();
+			flush_output ();
+		}
+
+		// let other threads know how we're doing before we go to sleep
+		io_idle.store (connection == CONNECTED && linkstate == LINK_READY && !running && manual_cmd.empty ()
+				&& inflight == 0 && txq_empty (&txq), memory_order_relaxed);
+		req_done.store (done, memory_order_release);
+
+		int nfds = 1;
+		pfd[0].fd = wakefd[0];
+		pfd[0].events = POLLIN;
+		if (connection == CONNECTED) {
+			pfd[1].fd = spfd;
+			pfd[1].events = txq_empty (&txq) ? POLLIN : POLLIN | POLLOUT;	// if the port couldn't take everything, wait for it to drain
+			pfd[1].revents = 0;
+			nfds = 2;
+		}
+		if (poll (pfd, nfds, timeout) < 0) {
+			if (errno != EINTR) perror ("iocore_mainloop: poll");
+			continue;
+		}
+		if (pfd[0].revents & POLLIN) {
+			drain_wake ();
+		}
+		if (nfds == 2 && (pfd[1].revents & (POLLHUP | POLLERR))) {
+			log_info ("Lost connection to the router.");
+			if (running) stop_job ();
+			connection = DISCONNECTED;
+			continue;
+		}
+		if (nfds == 2 && (pfd[1].revents & POLLIN)) {
+			int n;
+			do {	// normally one read drains the port; we only go around again if the ring filled up
+				n = rx_fill (&rxring, spfd);
+				if (n <= 0) break;
+				iostats.reads++;
+				iostats.bytes_in += n;
+				rx_event_t ev;
+				while (rx_next (&rxp, &rxring, &ev)) {
+					handle_event (&ev);
+				}
+			} while (n == RX_RING_SIZE);
 		}
-		usleep (1000);	// run through the loop every millisecond
-		n = serialport_read (spfd, &inp);	// now make the read on the serial port
 	}
 }
 
-// resend the last sent command (top of the 'sent' list)
+/* Go back N. ACKs come back in order, so the router is stuck on the oldest unACKed command:
+ * it throws away everything after that until it sees it again, asking for a retransmit for
+ * each one. So we send the lot again, from the oldest on, and ignore the requests that the
+ * frames already on their way will bring. Anything that hasn't started going out yet is
+ * dropped first, since it's about to be sent again in order anyway. */
 void retransmit () {
-	console_append ("Retransmitting command");
-	cmd_println (sent[0]);
+	if (inflight == 0) {
+		log_info ("Retransmit requested, but nothing is outstanding");
+		return;
+	}
+	if (aborted) return;	// it's forgotten all of them; and mustn't lose a queued STOP
+	txslot_t *slot = &window[oldest & 0xff];
+	unsigned int started = txq.tail + (txq.off > 0);	// frames that have at least started going out
+	if ((int) (started - slot->txi) <= 0) return;	// an earlier copy of it, and the latest is still to go
+	tx_skip = started - slot->txi - 1;
+	log_info ("Retransmitting from command %s", log_bytes (slot->c.bytes, COM_SIZE));
 
-	serialport_write (spfd, &(sent[0].bytes), COM_SIZE);
+	txq_discard (&txq);
+	for (unsigned short seq = oldest; seq != next_seq; seq++) {
+		slot = &window[seq & 0xff];
+		slot->txi = txq.head;
+		queue_frame (slot->wire, slot->wirelen);
+		iostats.sent++;
+		iostats.retransmits++;
+	}
 }
 
+void iocore_print_stats () {
+	float depth = iostats.acks ? iostats.depth_sum / (float) iostats.acks : 0;
+	float full = iostats.acks ? 100.0f * iostats.full_acks / iostats.acks : 0;
+	log_info ("Sent %lu frames (%lu retransmits); mean window depth %.1f/%d, full for %.0f%% of ACKs",
+			iostats.sent, iostats.retransmits, depth, TX_WINDOW, full);
+	log_info ("%lu bytes in %lu writes (%.1f bytes/write), at most %d bytes queued; %lu bytes in %lu reads",
+			iostats.bytes_out, iostats.writes, iostats.writes ? iostats.bytes_out / (float) iostats.writes : 0,
+			iostats.max_queued, iostats.bytes_in, iostats.reads);
+}
 
 /* Here are methods to format the responses from the router according to the command
  * type that provoked them */
 
-// utility method for endianness conversion in the response buffer
-uint16_t get16 (int idx) {
-	return (((uint16_t) response_buffer[idx*2]) << 8) + response_buffer[idx*2+1];
+// utility method for endianness conversion in the response data
+static uint16_t get16 (uchar *data, int idx) {
+	return (((uint16_t) data[idx*2]) << 8) + data[idx*2+1];
 }
 
-void print_response () {
-	// search for the most recently sent command with the ID indicated in the response
-	int idx = -1;
-	for (int i = 0; i < sent.size(); i++) {
-		if (sent[i].bytes[1] == response_id) {
-			idx = i;
-			break;
-		}
-	}
-	comtype_t ct;
-	if (idx == -1) {	// if no command was found, treat it as an ECHO command
-		ct = ECHO;
-	} else {
-		ct = (comtype_t) sent[idx].bytes[0];
-	}
+void print_response (rx_event_t *ev) {
+	// the window table holds the most recently sent command with each ID
+	comtype_t ct = (comtype_t) window[ev->id].c.bytes[0];
+	uchar *data = ev->data;
 
-	printf ("Response to %d\n", response_id);
-	uchar r0 = response_buffer[0];
-	char buf[200];
-	switch (ct) {
-		case QPOS:
-			sprintf (buf, "X: %f   Y: %f   Z: %f", get16(0) * 0.01f, get16(1) * 0.01f, get16(2) * 0.01f);
+	log_printf (LOG_DEBUG, LOGC_TRACE, "Response to %d", ev->id);
+	uchar r0 = data[0];
+	const cmdschema_t *s = cmd_schema_of (ct);
+	switch (s ? s->resp : RESP_ECHO) {	// the schema says what the answer to each command looks like
+		case RESP_POS:
+			log_printf (LOG_INFO, LOGC_RESP, "X: %f   Y: %f   Z: %f", get16(data, 0) * 0.01f, get16(data, 1) * 0.01f, get16(data, 2) * 0.01f);
+			break;
+		case RESP_ENDSTOPS:
+			log_printf (LOG_INFO, LOGC_RESP, "%s: X: %d  Y: %d  Z: %d", s->label, r0 & 1, (r0 & 2) >> 1, (r0 & 4) >> 2);
 			break;
-		case QEND:
-			sprintf (buf, "Endstops: X: %d  Y: %d  Z: %d", r0 & 1, (r0 & 2) >> 1, (r0 & 4) >> 2);
+		case RESP_U32:
+			log_printf (LOG_INFO, LOGC_RESP, "%s: %u", s->label, (unsigned int) ((data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3]));
 			break;
-		case QSPS:
-			sprintf (buf, "Spindle speed: %d rpm", (int) (SP_SPEED_MIN + (get16(1) / 1024.0f) * (SP_SPEED_MAX - SP_SPEED_MIN)));
+		case RESP_SPINDLE:
+			log_printf (LOG_INFO, LOGC_RESP, "%s: %d rpm", s->label, (int) (SP_SPEED_MIN + (get16(data, 1) / 1024.0f) * (SP_SPEED_MAX - SP_SPEED_MIN)));
 			break;
-		case ECHO:
+		case RESP_ECHO:
 		default:
-			response_buffer[response_len] = 0;	// ensure we have null-termination
-			sprintf (buf, "ECHO: %s", response_buffer);
+			log_printf (LOG_INFO, LOGC_RESP, "ECHO: %s", log_copy ((char *) data, ev->len));
 	}
-	console_append (string (buf));
 }
@@ -4,16 +4,16 @@
 #include "serial.h"
 #include "config.h"
 #include "command.h"
+#include "rxparse.h"
+#include "txqueue.h"
+#include "spsc.h"
+#include "logger.h"
+#include "job.h"
+#include "planner.h"
 #include <pthread.h>
 #include <vector>
 #include <deque>
-
-// possible states of the communication
-#define IDLE 0
-#define ACK 1
-#define RESPONSE 2
-#define RETRANSMIT 3
-#define ABORT 4
+#include <atomic>
 
 // possible states of the connection
 #define DISCONNECTED 0
@@ -21,14 +21,34 @@
 #define CONNECTED 2
 
 #define BUFFER_SIZE 16
+#define MANUAL_QUEUE_SIZE 256	// manual commands that can be waiting to go out (power of 2)
+
+// counters for keeping an eye on how well the transmit window is being used.
+typedef struct {
+	unsigned long sent;			// frames written, including retransmits
+	unsigned long retransmits;
+	unsigned long acks;
+	unsigned long full_acks;	// ACKs that arrived while the window was completely full
+	unsigned long depth_sum;	// in-flight count sampled at each ACK; depth_sum / acks is the mean window depth
+	unsigned long reads;		// read syscalls that returned data
+	unsigned long bytes_in;
+	unsigned long writes;		// write syscalls that got something out
+	unsigned long bytes_out;
+	int max_queued;				// high water mark of bytes waiting in the output queue
+} iocore_stats_t;
 
 extern int err;
-extern int connection;
-extern pthread_mutex_t iomutex;
+extern std::atomic<int> connection;
+extern std::atomic<int> progress;	// how many commands of the running job have been sent
+extern std::atomic<int> acked;		// and how many the router has ACKed
+extern std::atomic<int> checkpoint;	// where a job that was stopped part way can carry on from (-1: none)
 extern pthread_t iothread;
+extern iocore_stats_t iostats;
+extern void (*iocore_ack_hook) (unsigned short seq, long latency_us);	// if set, called on every ACK
 
 void iocore_init ();
-void iocore_load ( std::vector< command_t>);
+void iocore_set_port (const char *);
+void iocore_load (job_t *);
 
 void iocore_connect ();
 void iocore_disconnect ();
@@ -36,10 +56,18 @@ void iocore_disconnect ();
 bool iocore_run_manual (command_t);
 bool iocore_run_manualv ( std::vector<command_t> );
 void iocore_run_auto ();
+void iocore_run_from (int start, job_t *preamble);	// start the job at command 'start', after the preamble
+void iocore_estop ();
+void iocore_wake ();
 
 void *iocore_mainloop (void *);
-void print_response();
+void print_response (rx_event_t *);
 
 void retransmit();
+void iocore_print_stats ();
+int iocore_queued_bytes ();
+bool iocore_idle ();
+bool iocore_running ();
+void iocore_machine (postrack_t *);	// where what's been sent so far takes the machine (any thread)
 
 #endif
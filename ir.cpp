@@ -0,0 +1,124 @@
+#include "ir.h"
+#include "schema.h"
+#include <cstring>
+using namespace std;
+
+int ir_nargs (int op) {
+	return schema_index.words[op & 0xff];
+}
+
+static inline bool is_move (int op) {
+	return op == MOVA || op == MOVR || op == MARC || op == MHLX;
+}
+
+void ir_clear (jobir_t *ir) {
+	ir->op.clear ();
+	ir->same.clear ();
+	ir->lstep.clear ();
+	ir->pool.clear ();
+	ir->far_line.clear ();
+	ir->mark.clear ();
+	memset (&ir->tail, 0, sizeof(ir->tail));
+}
+
+void ir_push (jobir_t *ir, const ircmd_t *c) {
+	ircursor_t *t = &ir->tail;
+	if (t->n % IR_MARK_EVERY == 0) {
+		irmark_t m;
+		m.pool = t->pool;
+		m.far = t->far;
+		m.line = t->line;
+		memcpy (m.last, t->last, sizeof(m.last));
+		ir->mark.push_back (m);
+	}
+	ir->op.push_back (c->op);
+	int step = c->line - t->line;
+	if (step >= 0 && step < IR_FAR_LINE) {
+		ir->lstep.push_back (step);
+	} else {
+		ir->lstep.push_back (IR_FAR_LINE);
+		ir->far_line.push_back (c->line);
+		t->far++;
+	}
+	t->line = c->line;
+
+	int n = ir_nargs (c->op);
+	if (is_move (c->op)) {	// operands are compared as bits, so what comes back is exactly what went in
+		uchar same = 0;
+		for (int i=0; i < n; i++) {
+			if (c->a.i[i] == t->last[i]) {
+				same |= 1 << i;
+			} else {
+				ir->pool.push_back (c->a.i[i]);
+				t->last[i] = c->a.i[i];
+				t->pool++;
+			}
+		}
+		ir->same.push_back (same);
+	} else {
+		ir->pool.insert (ir->pool.end (), c->a.i, c->a.i + n);
+		ir->same.push_back (0);
+		t->pool += n;
+	}
+	t->n++;
+}
+
+void ir_shrink (jobir_t *ir) {
+	ir->op.shrink_to_fit ();
+	ir->same.shrink_to_fit ();
+	ir->lstep.shrink_to_fit ();
+	ir->pool.shrink_to_fit ();
+	ir->far_line.shrink_to_fit ();
+	ir->mark.shrink_to_fit ();
+}
+
+size_t ir_memory (const jobir_t *ir) {
+	return ir->op.capacity () + ir->same.capacity () + ir->lstep.capacity ()
+			+ ir->pool.capacity () * sizeof(int32_t) + ir->far_line.capacity () * sizeof(int)
+			+ ir->mark.capacity () * sizeof(irmark_t);
+}
+
+// start from the nearest mark at or before n, and step forward from there
+void ir_seek (const jobir_t *ir, ircursor_t *cur, size_t n) {
+	memset (cur, 0, sizeof(*cur));
+	if (n > ir_size (ir)) n = ir_size (ir);
+	size_t k = n / IR_MARK_EVERY;
+	if (k < ir->mark.size ()) {
+		const irmark_t *m = &ir->mark[k];
+		cur->n = k * IR_MARK_EVERY;
+		cur->pool = m->pool;
+		cur->far = m->far;
+		cur->line = m->line;
+		memcpy (cur->last, m->last, sizeof(cur->last));
+	}
+	ircmd_t junk;
+	while (cur->n < n) ir_next (ir, cur, &junk);
+}
+
+bool ir_next (const jobir_t *ir, ircursor_t *cur, ircmd_t *c) {
+	size_t i = cur->n;
+	if (i >= ir->op.size ()) return false;
+	c->op = ir->op[i];
+	uchar step = ir->lstep[i];
+	cur->line = step == IR_FAR_LINE ? ir->far_line[cur->far++] : cur->line + step;
+	c->line = cur->line;
+
+	int n = ir_nargs (c->op);
+	const int32_t *p = ir->pool.data () + cur->pool;
+	memset (&c->a, 0, sizeof(c->a));
+	if (is_move (c->op)) {
+		uchar same = ir->same[i];
+		for (int k=0; k < n; k++) {
+			if (!(same & (1 << k))) {
+				cur->last[k] = *p++;
+			}
+			c->a.i[k] = cur->last[k];
+		}
+		cur->pool = p - ir->pool.data ();
+	} else {
+		memcpy (c->a.i, p, n * sizeof(int32_t));
+		cur->pool += n;
+	}
+	cur->n++;
+	return true;
+}
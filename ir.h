@@ -0,0 +1,58 @@
+/* ir.h - the in-memory form of a job: a compact structure of arrays of ircmd_t */
+#ifndef IR_H
+#define IR_H
+
+#include "command.h"
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+#define IR_MARK_EVERY 256	// commands between the checkpoints that let ir_seek start partway through
+#define IR_FAR_LINE 255		// line step meaning "the line is in far_line"
+
+// where a pass over a jobir_t has got to. It's also all the state needed to carry on from there.
+typedef struct {
+	size_t n;			// index of the next command
+	size_t pool;		// and where its operands start
+	size_t far;			// next entry in far_line
+	int line;			// line of the previous command
+	int32_t last[CMD_MAX_ARGS];	// operands of the last move
+} ircursor_t;
+
+// see ir_seek
+typedef struct {
+	uint32_t pool, far;
+	int line;
+	int32_t last[CMD_MAX_ARGS];
+} irmark_t;
+
+/* A job is kept as parallel arrays rather than a list of frames. Each command has an opcode
+ * and the step from the previous command's line (usually 1) in a byte each; its operands go
+ * in a shared pool, only as many as the opcode takes. Moves usually repeat some of the last
+ * move's operands (Z and the feedrate, mostly), so for those a 'same' bitmask says which ones
+ * were left out. A typical 2D move comes to 11 bytes, against 20 for the frame and 24 for a
+ * frame plus its line. Reading it back means going through in order with a cursor, which is
+ * how everything uses a job anyway; the marks make starting in the middle cheap. */
+typedef struct jobir_t {
+	std::vector<uchar> op;
+	std::vector<uchar> same;	// moves: bit n set if operand n is the last move's, and isn't in the pool
+	std::vector<uchar> lstep;	// line minus the previous command's line, or IR_FAR_LINE
+	std::vector<int32_t> pool;	// operands (floats are kept as their bits)
+	std::vector<int> far_line;	// lines that didn't fit in a step, in order
+	std::vector<irmark_t> mark;	// the cursor state at every IR_MARK_EVERYth command
+	ircursor_t tail;			// the cursor state at the end, for appending
+} jobir_t;
+
+void ir_clear (jobir_t *);
+void ir_push (jobir_t *, const ircmd_t *);
+void ir_shrink (jobir_t *);		// give back the spare capacity once it's complete
+
+static inline size_t ir_size (const jobir_t *ir) { return ir->op.size (); }
+size_t ir_memory (const jobir_t *);	// bytes used
+
+void ir_seek (const jobir_t *, ircursor_t *, size_t n);	// position a cursor at command n
+bool ir_next (const jobir_t *, ircursor_t *, ircmd_t *);	// the next command, or false at the end
+
+int ir_nargs (int op);		// operands an opcode takes in the pool
+
+#endif
@@ -0,0 +1,52 @@
+#include "job.h"
+using namespace std;
+
+static job_t *job_alloc (int kind) {
+	job_t *j = new job_t;
+	j->refs.store (1, memory_order_relaxed);
+	j->kind = kind;
+	j->stream = NULL;
+	j->rjob = NULL;
+	return j;
+}
+
+job_t *job_new (jobir_t *ir) {
+	job_t *j = job_alloc (JOB_COMMANDS);
+	swap (j->ir, *ir);
+	ir_shrink (&j->ir);
+	return j;
+}
+
+job_t *job_new_stream (gstream_t *gs) {
+	job_t *j = job_alloc (JOB_STREAM);
+	j->stream = gs;
+	return j;
+}
+
+job_t *job_new_cached (rjob_t *rj) {
+	job_t *j = job_alloc (JOB_CACHED);
+	j->rjob = rj;
+	return j;
+}
+
+job_t *job_ref (job_t *j) {
+	if (j != NULL) j->refs.fetch_add (1, memory_order_relaxed);
+	return j;
+}
+
+// the release/acquire pair makes sure everything the other holders did with the job is
+// finished before it's freed
+void job_unref (job_t *j) {
+	if (j == NULL || j->refs.fetch_sub (1, memory_order_acq_rel) != 1) return;
+	gstream_close (j->stream);
+	rjob_close (j->rjob);
+	delete j;
+}
+
+size_t job_count (const job_t *j) {
+	switch (j->kind) {
+		case JOB_STREAM:	return j->stream->parsed.load (memory_order_relaxed);
+		case JOB_CACHED:	return j->rjob->count;
+		default:			return ir_size (&j->ir);
+	}
+}
@@ -0,0 +1,41 @@
+/* job.h - a loaded job, however it came in: commands held in memory, a file being
+ * streamed in as it's parsed, or a file mapped in from the job cache */
+#ifndef JOB_H
+#define JOB_H
+
+#include "command.h"
+#include "loader.h"
+#include "rjob.h"
+#include "ir.h"
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+// kinds of job
+#define JOB_COMMANDS 0	// held in memory
+#define JOB_STREAM 1
+#define JOB_CACHED 2
+
+/* A job is made once and never changed after that, so any number of threads can hold on to
+ * it. It's reference counted: whoever makes one owns the first reference, passing a job to
+ * something that keeps it (like iocore_load) hands that reference over, and the last
+ * job_unref frees it along with the commands, stream or cache it owns. Nothing is copied on
+ * the way. (A stream's parse state does change as it's sent, but only the I/O thread touches
+ * that.) */
+typedef struct {
+	std::atomic<int> refs;
+	int kind;
+	jobir_t ir;					// JOB_COMMANDS
+	gstream_t *stream;			// JOB_STREAM
+	rjob_t *rjob;				// JOB_CACHED
+} job_t;
+
+job_t *job_new (jobir_t *ir);	// takes the commands, leaving *ir empty
+job_t *job_new_stream (gstream_t *);
+job_t *job_new_cached (rjob_t *);
+job_t *job_ref (job_t *);
+void job_unref (job_t *);
+
+size_t job_count (const job_t *);	// commands in the job (for a stream, as many as are known so far)
+
+#endif
@@ -0,0 +1,86 @@
+#include "linearize.h"
+#include "compact.h"
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+#define LIN_BLOCK 256	// pieces made at a time
+
+void lin_init (linearizer_t *l) {
+	l->feed = 0;
+	l->n = l->k = 0;
+	l->arcs = 0;
+	l->pieces = 0;
+	l->max_err = 0;
+	l->out.clear ();
+}
+
+void lin_push (linearizer_t *l, const ircmd_t *c) {
+	if (!ARC_LINEARIZE || (c->op != MARC && c->op != MHLX)) {
+		l->out.push_back (*c);
+		if (c->op == MOVA || c->op == MOVR) l->feed = c->a.f[3];
+		return;
+	}
+	if (c->op == MARC) l->feed = c->a.f[3];
+	double r = fabs (c->a.f[0]), th = c->a.f[1] * M_PI / 180, sweep = c->a.f[2] * M_PI / 180;
+	double z = c->op == MHLX ? c->a.f[3] * c->a.f[2] / 360 : 0;
+
+	// as few pieces as keep to the tolerance, and never more than that
+	double step = r > LINEARIZE_TOLERANCE ? 2 * acos (1 - LINEARIZE_TOLERANCE / r) : M_PI / 2;
+	step = min (step, M_PI / 2);
+	int n = max (1.0, ceil (fabs (sweep) / step));
+
+	/* Fewer, if the link can't keep up with that many. This runs ahead of the planner, which
+	 * can only slow the arc down, so the time it'd take at the feedrate (or at the most the
+	 * planner lets a curve that tight go) is the least it can take, and the rate holds whatever
+	 * the planner does with it. Pieces are never more than a quarter turn, though. */
+	float v = l->feed;
+	if (PLAN_MOTION && r > 0) v = min (v, sqrtf (min (PLAN_ACCEL[0], PLAN_ACCEL[1]) * r));
+	if (v > 0) {
+		double secs = hypot (r * sweep, z) / v;
+		int most = max (floor (secs * LINEARIZE_RATE), ceil (fabs (sweep) / (M_PI / 2)));
+		n = max (1, min (n, most));
+	}
+	l->max_err = max (l->max_err, r * (1 - cos (sweep / n / 2)));
+
+	l->line = c->line;
+	l->n = n;
+	l->k = 0;
+	l->r0x = l->cx = r * cos (th);
+	l->r0y = l->cy = r * sin (th);
+	l->ca = cos (sweep / n);
+	l->sa = sin (sweep / n);
+	l->dz = z / n;
+	l->end[0] = r * cos (th + sweep) - l->r0x;
+	l->end[1] = r * sin (th + sweep) - l->r0y;
+	l->end[2] = z;
+	for (int i=0; i < 3; i++) l->sent[i] = 0;
+	l->arcs++;
+	l->pieces += n;
+}
+
+/* The points go round by a rotation rather than a sin and cos each, which is all the trig
+ * there'd otherwise be per piece; a long helix is turned round thousands of times, but in
+ * doubles the error that builds up is still far below the grid. */
+bool lin_more (linearizer_t *l) {
+	if (l->k >= l->n) return false;
+	int stop = min (l->n, l->k + LIN_BLOCK);
+	while (l->k < stop) {
+		l->k++;
+		double nx = l->cx * l->ca - l->cy * l->sa;
+		l->cy = l->cx * l->sa + l->cy * l->ca;
+		l->cx = nx;
+		double p[3] = {l->cx - l->r0x, l->cy - l->r0y, l->k * l->dz};
+		if (l->k == l->n) {
+			for (int i=0; i < 3; i++) p[i] = l->end[i];
+		}
+		ircmd_t m = {MOVR, l->line, {{0, 0, 0, l->feed}}};
+		for (int i=0; i < 3; i++) {
+			double q = hundredths (p[i]);
+			m.a.f[i] = q - l->sent[i];
+			l->sent[i] = q;
+		}
+		l->out.push_back (m);
+	}
+	return true;
+}
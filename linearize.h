@@ -0,0 +1,40 @@
+/* linearize.h - turns MARC and MHLX into short straight moves on the host, for firmware that's
+ * too slow doing the trig for an arc itself (and so arcs don't have to get along with the skew
+ * and rotation correction). */
+#ifndef LINEARIZE_H
+#define LINEARIZE_H
+
+#include "command.h"
+#include <vector>
+
+/* An arc is cut into equal pieces, as few as keep the chord within LINEARIZE_TOLERANCE of the
+ * arc, unless that's more than the link can send in the least time the arc can take (at its
+ * feedrate, or as fast as the planner lets it round the curve if that's slower); then it's as
+ * many as it can, and the chordal error is what it has to be. The pieces go out
+ * as MOVR, with the points rounded to the 0.01 mm grid the firmware works in, so they add up
+ * to just the arc's end.
+ *
+ * A long helix can be a great many pieces, so they're made LIN_BLOCK at a time: after
+ * lin_push, call lin_more until it returns false, taking 'out' each time. */
+typedef struct {
+	float feed;				// the feedrate there is (the one a MHLX goes at)
+	// the arc being cut up
+	int line;
+	int n, k;				// pieces in all, and made so far
+	double r0x, r0y;		// position relative to the centre at the start
+	double cx, cy;			// and at the end of piece k
+	double ca, sa;			// cos and sin of the angle each piece turns through
+	double dz;				// Z per piece
+	double end[3];			// where the arc ends, relative to where it starts
+	double sent[3];			// where the pieces so far have taken it (on the grid)
+	unsigned long arcs;		// arcs cut up so far
+	unsigned long pieces;	// and the pieces they made
+	double max_err;			// mm: the largest chordal error there's been
+	std::vector<ircmd_t> out;	// what's ready to go on (the caller empties it)
+} linearizer_t;
+
+void lin_init (linearizer_t *);
+void lin_push (linearizer_t *, const ircmd_t *);
+bool lin_more (linearizer_t *);		// make the next lot of pieces; false once the arc is done
+
+#endif
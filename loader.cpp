@@ -0,0 +1,186 @@
+#include "loader.h"
+#include "logger.h"
+#include "workpool.h"
+#include "pipeline.h"
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+// map a file for streaming. Returns NULL if it can't be opened.
+gstream_t *gstream_open (const char *path) {
+	int fd = open (path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat (fd, &st) < 0) {
+		close (fd);
+		return NULL;
+	}
+	const char *data = NULL;
+	if (st.st_size > 0) {
+		data = (const char *) mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close (fd);
+			return NULL;
+		}
+		madvise ((void *) data, st.st_size, MADV_SEQUENTIAL);
+	}
+
+	gstream_t *gs = new gstream_t;
+	gs->fd = fd;
+	gs->data = data;
+	gs->len = st.st_size;
+	gs->thread_started = false;
+	gs->stop = false;
+	gs->state = STREAM_IDLE;
+	gs->starved = false;
+	gs->parsed = 0;
+	gs->err_line = 0;
+	gs->err_msg = NULL;
+	gs->notify = NULL;
+	gs->reported = false;
+	return gs;
+}
+
+// let a consumer that ran dry know there's something for it. The fence pairs with the one
+// in gstream_pop, so that either we see the flag or the consumer sees what we just pushed.
+static void wake_consumer (gstream_t *gs) {
+	atomic_thread_fence (memory_order_seq_cst);
+	if (gs->starved.load (memory_order_relaxed) && gs->starved.exchange (false) && gs->notify) {
+		gs->notify ();
+	}
+}
+
+// put one command on the queue, waiting for room. Returns false if we've been told to stop.
+static bool enqueue (gstream_t *gs, ircmd_t *c) {
+	int nap = 500;
+	while (!gs->queue.push (*c)) {	// full: wait for the consumer to catch up
+		wake_consumer (gs);
+		if (gs->stop.load (memory_order_relaxed)) return false;
+		usleep (nap);
+		if (nap < 20000) nap *= 2;	// a full queue is far more than 20 ms of work
+	}
+	wake_consumer (gs);
+	return true;
+}
+
+// hand what's come out of the pipeline over to the queue. Returns false if we've been told to stop.
+static bool drain (gstream_t *gs, pipeline_t *pl, unsigned long *n) {
+	vector<ircmd_t> &out = pipe_out (pl);
+	for (size_t k=0; k < out.size(); k++) {
+		if (!enqueue (gs, &out[k])) return false;
+		gs->parsed.store (++*n, memory_order_relaxed);
+	}
+	out.clear ();
+	return true;
+}
+
+/* The loader thread. The file is parsed a batch at a time, with a piece per thread in the work
+ * pool, and the pieces are fed through the pipeline (simplification and planning) into the queue in order. The very
+ * first piece is small and parsed on its own, so the first commands are ready right away. */
+static void stream_job (gstream_t *gs, pipeline_t *pl) {
+	const char *s = gs->data, *end = gs->data + gs->len;
+	int line0 = 0;
+	unsigned long n = 0;
+	size_t size = STREAM_FIRST_CHUNK;
+	int count = 1;
+	vector<gchunk_t> batch;
+	pipe_init (pl);
+	while (s < end) {
+		batch.clear ();
+		s = split_gcode (s, end, size, count, &batch);
+		parse_gcode_chunks (&batch);
+		for (size_t i=0; i < batch.size(); i++) {
+			gchunk_t *ch = &batch[i];
+			int bad = ch->errors.empty () ? INT_MAX : ch->errors[0].line;
+			for (size_t k=0; k < ch->cmd.size() && ch->cmd[k].line < bad; k++) {
+				ircmd_t c = ch->cmd[k];
+				c.line += line0;
+				pipe_push (pl, &c);
+				do {
+					if (!drain (gs, pl, &n)) return;
+				} while (pipe_more (pl));
+			}
+			if (bad != INT_MAX) {
+				pipe_finish (pl);
+				if (!drain (gs, pl, &n)) return;
+				gs->err_line = line0 + bad;
+				gs->err_msg = ch->errors[0].msg;
+				log_error ("ERROR in line %d: %s", gs->err_line, gs->err_msg);
+				gs->state.store (STREAM_FAILED, memory_order_release);
+				wake_consumer (gs);
+				return;
+			}
+			line0 += ch->lines;
+		}
+		if (gs->stop.load (memory_order_relaxed)) return;
+		size = PARSE_CHUNK;
+		count = pool_threads ();
+	}
+	pipe_finish (pl);
+	if (drain (gs, pl, &n)) {
+		if (!gs->reported) {	// say what the passes made of it, the first time through
+			jobstats_t st;
+			pipe_stats (pl, &st);
+			log_jobstats (&st);
+			gs->reported = true;
+		}
+		gs->state.store (STREAM_DONE, memory_order_release);
+		wake_consumer (gs);
+	}
+}
+
+static void *gstream_main (void *arg) {
+	pipeline_t pl;
+	stream_job ((gstream_t *) arg, &pl);
+	return NULL;
+}
+
+// stop the loader thread (if it's going) and wait for it
+static void gstream_halt (gstream_t *gs) {
+	if (!gs->thread_started) return;
+	gs->stop = true;
+	pthread_join (gs->thread, NULL);
+	gs->thread_started = false;
+	gs->stop = false;
+}
+
+/* (Re)start parsing from the top of the file. Anything still queued from a previous pass is
+ * thrown away, so this has to be called by whichever thread is consuming the stream. */
+void gstream_start (gstream_t *gs) {
+	gstream_halt (gs);
+	ircmd_t junk;
+	while (gs->queue.pop (&junk));
+	gs->parsed = 0;
+	gs->err_line = 0;
+	gs->err_msg = NULL;
+	gs->starved = false;
+	gs->state = STREAM_PARSING;
+	gs->thread_started = true;
+	pthread_create (&gs->thread, NULL, gstream_main, gs);
+}
+
+void gstream_close (gstream_t *gs) {
+	if (gs == NULL) return;
+	gstream_halt (gs);
+	if (gs->data != NULL) munmap ((void *) gs->data, gs->len);
+	close (gs->fd);
+	delete gs;
+}
+
+// take the next command, if one is ready. If not, the loader calls notify once there is.
+bool gstream_pop (gstream_t *gs, ircmd_t *c) {
+	if (gs->queue.pop (c)) return true;
+	gs->starved.store (true, memory_order_relaxed);
+	atomic_thread_fence (memory_order_seq_cst);
+	return gs->queue.pop (c);	// in case one arrived before the loader could see the flag
+}
+
+// true once everything the loader will ever produce has been taken
+bool gstream_finished (gstream_t *gs) {
+	int st = gs->state.load (memory_order_acquire);
+	return st != STREAM_PARSING && gs->queue.empty ();
+}
@@ -0,0 +1,53 @@
+/* loader.h - streams a G-code file from disk to the I/O thread while it's being parsed */
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "command.h"
+#include "spsc.h"
+#include <pthread.h>
+#include <atomic>
+#include <cstddef>
+
+#define STREAM_QUEUE_SIZE 4096	// parsed commands that can be waiting to be sent (power of 2)
+#define STREAM_FIRST_CHUNK (16 * 1024)	// bytes parsed before the first commands are handed over
+
+// states of a stream
+#define STREAM_IDLE 0		// not started
+#define STREAM_PARSING 1
+#define STREAM_DONE 2		// reached the end of the file
+#define STREAM_FAILED 3		// hit a malformed line; everything before it was queued
+
+/* The file is memory mapped, and a loader thread parses it from the top into a bounded queue
+ * that the I/O thread takes commands from as the window allows. When the queue is full the
+ * loader waits, so memory use doesn't depend on the size of the file (just on the size of a
+ * batch of pieces; see gstream_main), and the job can start going out as soon as the first
+ * commands are parsed. Running the job again means parsing it again (gstream_start), which
+ * is cheap next to sending it. Everything goes through the pipeline (pipeline.h) on the way
+ * into the queue. */
+typedef struct {
+	int fd;
+	const char *data;	// the mapped file
+	size_t len;
+
+	Spscqueue<ircmd_t, STREAM_QUEUE_SIZE> queue;	// loader thread -> consumer
+	pthread_t thread;
+	bool thread_started;
+	std::atomic<bool> stop;			// asks the loader thread to quit
+	std::atomic<int> state;
+	std::atomic<bool> starved;		// the consumer found the queue empty and wants to hear about more
+	std::atomic<unsigned long> parsed;	// commands produced so far this pass
+	int err_line;					// where it failed, once state is STREAM_FAILED
+	const char *err_msg;
+	bool reported;					// what the pipeline did has been logged
+	void (*notify) ();				// called (on the loader thread) when a starved consumer has something to do
+} gstream_t;
+
+gstream_t *gstream_open (const char *path);
+void gstream_start (gstream_t *);
+void gstream_close (gstream_t *);
+
+// consumer side
+bool gstream_pop (gstream_t *, ircmd_t *);
+bool gstream_finished (gstream_t *);
+
+#endif
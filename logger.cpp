@@ -0,0 +1,267 @@
+#include "logger.h"
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+using namespace std;
+
+/* The ring is a bounded multi-producer queue (one consumer: the logger thread). Each slot has
+ * its own sequence number. A slot is free for the producer claiming position p when its number
+ * is p, and holds a finished record for the consumer when it's p+1; the consumer sets it to
+ * p+LOG_RING when it's done, which frees it for the next lap. Producers race for positions
+ * with a compare-and-swap, so nobody ever waits on a lock, and a producer that finds the ring
+ * full just drops its message. */
+static logrec_t ring[LOG_RING];
+static atomic<unsigned int> enq_pos (0);
+static unsigned int deq_pos = 0;			// only touched by the logger thread
+static atomic<unsigned int> formatted (0);	// copy of deq_pos for log_flush
+
+atomic<int> log_level (LOG_MIN_LEVEL);
+atomic<unsigned int> log_mask ((1u << LOGC_CONSOLE) | (CONSOLE_ACK << LOGC_ACK) | (CONSOLE_PING << LOGC_PING)
+		| (CONSOLE_SEND << LOGC_SEND) | (CONSOLE_RESP << LOGC_RESP) | (1u << LOGC_TRACE));
+atomic<unsigned long> log_dropped (0);
+
+typedef struct {
+	log_sink_t fn;
+	unsigned int catmask;
+	int level;
+} sinkent_t;
+
+static sinkent_t sinks[LOG_MAX_SINKS];
+static atomic<int> nsinks (0);
+static pthread_t logthread;
+static bool started = false;
+
+static long now_us () {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+// grab the next free slot, or NULL if the ring is full
+logrec_t *log_claim (int level, int cat) {
+	unsigned int p = enq_pos.load (memory_order_relaxed);
+	logrec_t *r;
+	while (true) {
+		r = &ring[p & (LOG_RING - 1)];
+		int diff = (int) (r->seq.load (memory_order_acquire) - p);
+		if (diff == 0) {
+			if (enq_pos.compare_exchange_weak (p, p + 1, memory_order_relaxed)) break;
+		} else if (diff < 0) {	// the consumer hasn't freed this one yet
+			log_dropped.fetch_add (1, memory_order_relaxed);
+			return NULL;
+		} else {				// someone else got there first
+			p = enq_pos.load (memory_order_relaxed);
+		}
+	}
+	r->level = level;
+	r->cat = cat;
+	r->nargs = 0;
+	r->textlen = 0;
+	r->time_us = now_us ();
+	return r;
+}
+
+// hand a filled-in slot over to the logger thread
+void log_commit (logrec_t *r) {
+	unsigned int p = r->seq.load (memory_order_relaxed);
+	r->seq.store (p + 1, memory_order_release);
+}
+
+// copy text into the record; it's truncated if the record runs out of room
+void log_pack_text (logrec_t *r, int i, const char *p, int len, char type) {
+	if (len < 0) len = strlen (p);
+	int room = LOG_TEXT_MAX - r->textlen;
+	if (len > room) len = room;
+	memcpy (r->text + r->textlen, p, len);
+	r->argtype[i] = type;
+	r->args[i].i = (r->textlen << 8) | len;
+	r->textlen += len;
+}
+
+// copy one conversion spec (flags, width and precision, without any length modifier) into spec
+static const char *get_spec (const char *f, char *spec, char *conv) {
+	int n = 0;
+	spec[n++] = *f++;	// the '%'
+	while (*f && strchr ("-+ #0123456789.", *f) && n < 16) spec[n++] = *f++;
+	while (*f && strchr ("hlLqjzt", *f)) f++;
+	*conv = *f;
+	spec[n] = 0;
+	return *f ? f + 1 : f;
+}
+
+// turn a record into text, printf style
+static void format_rec (logrec_t *r, char *out, int size) {
+	char *o = out, *end = out + size - 1;
+	int a = 0;
+	for (const char *f = r->fmt; *f && o < end; ) {
+		if (*f != '%') {
+			*o++ = *f++;
+			continue;
+		}
+		if (f[1] == '%') {
+			*o++ = '%';
+			f += 2;
+			continue;
+		}
+		char spec[24], conv;
+		f = get_spec (f, spec, &conv);
+		int len = strlen (spec);
+		if (a >= r->nargs) {
+			o += snprintf (o, end - o + 1, "?");
+		} else {
+			char t = r->argtype[a];
+			logarg_t v = r->args[a++];
+			switch (conv) {
+				case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+					spec[len] = 'l';
+					spec[len+1] = conv;
+					spec[len+2] = 0;
+					o += snprintf (o, end - o + 1, spec, t == 'f' ? (long) v.f : v.i);
+					break;
+				case 'c':
+					spec[len] = 'c';
+					spec[len+1] = 0;
+					o += snprintf (o, end - o + 1, spec, (int) v.i);
+					break;
+				case 'f': case 'F': case 'g': case 'G': case 'e': case 'E':
+					spec[len] = conv;
+					spec[len+1] = 0;
+					o += snprintf (o, end - o + 1, spec, t == 'i' ? (double) v.i : v.f);
+					break;
+				case 's':
+					spec[len] = 's';
+					spec[len+1] = 0;
+					if (t == 's') {
+						o += snprintf (o, end - o + 1, spec, v.s ? v.s : "(null)");
+					} else if (t == 't') {
+						char text[LOG_TEXT_MAX + 1];
+						memcpy (text, r->text + (v.i >> 8), v.i & 0xff);
+						text[v.i & 0xff] = 0;
+						o += snprintf (o, end - o + 1, spec, text);
+					} else if (t == 'b') {
+						const unsigned char *b = (const unsigned char *) r->text + (v.i >> 8);
+						for (int k=0; k < (v.i & 0xff) && o < end; k++) {
+							o += snprintf (o, end - o + 1, "%d ", b[k]);
+						}
+					} else {
+						o += snprintf (o, end - o + 1, "?");
+					}
+					break;
+				default:
+					o += snprintf (o, end - o + 1, "?");
+			}
+		}
+		if (o > end) o = end;	// snprintf tells us what it would have written
+	}
+	*o = 0;
+}
+
+// whether any sink is interested, so we don't format lines nobody will see
+static bool wanted (int level, int cat) {
+	int n = nsinks.load (memory_order_acquire);
+	for (int i=0; i < n; i++) {
+		if (level >= sinks[i].level && (sinks[i].catmask & (1u << cat))) return true;
+	}
+	return false;
+}
+
+// pass a finished line to every sink that wants it
+static void emit (int level, int cat, long time_us, const char *line) {
+	int n = nsinks.load (memory_order_acquire);
+	for (int i=0; i < n; i++) {
+		if (level >= sinks[i].level && (sinks[i].catmask & (1u << cat))) {
+			sinks[i].fn (level, cat, time_us, line);
+		}
+	}
+}
+
+// format and dispatch everything that's waiting. Returns the number of records handled.
+static int drain () {
+	int n = 0;
+	static unsigned long reported = 0;
+	unsigned long dropped = log_dropped.load (memory_order_relaxed);
+	if (dropped != reported) {
+		char line[80];
+		snprintf (line, sizeof(line), "(%lu log messages dropped)", dropped - reported);
+		reported = dropped;
+		emit (LOG_WARN, LOGC_CONSOLE, now_us (), line);
+	}
+	while (true) {
+		logrec_t *r = &ring[deq_pos & (LOG_RING - 1)];
+		if (r->seq.load (memory_order_acquire) != deq_pos + 1) break;
+		if (wanted (r->level, r->cat)) {
+			char line[LOG_LINE_MAX];
+			format_rec (r, line, sizeof(line));
+			emit (r->level, r->cat, r->time_us, line);
+		}
+		r->seq.store (deq_pos + LOG_RING, memory_order_release);
+		deq_pos++;
+		formatted.store (deq_pos, memory_order_release);
+		n++;
+	}
+	if (n > 0) fflush (stdout);
+	return n;
+}
+
+/* The logger thread polls the ring rather than being woken up, so that logging never costs the
+ * caller a system call. It checks often while messages are coming in and backs off when they aren't. */
+static void *log_mainloop (void *arg) {
+	int nap = 1000;
+	while (true) {
+		if (drain () > 0) {
+			nap = 1000;
+		} else if (nap < 20000) {
+			nap *= 2;
+		}
+		usleep (nap);
+	}
+	return NULL;
+}
+
+void log_init () {
+	if (started) return;
+	for (unsigned int i=0; i < LOG_RING; i++) {
+		ring[i].seq.store (i, memory_order_relaxed);
+	}
+	started = true;
+	pthread_create (&logthread, NULL, log_mainloop, NULL);
+}
+
+// sinks should be added before anything gets logged from other threads
+void log_add_sink (log_sink_t fn, unsigned int catmask, int level) {
+	int n = nsinks.load (memory_order_relaxed);
+	if (n == LOG_MAX_SINKS) return;
+	sinks[n].fn = fn;
+	sinks[n].catmask = catmask;
+	sinks[n].level = level;
+	nsinks.store (n + 1, memory_order_release);
+}
+
+void log_enable (int cat, bool on) {
+	if (on) {
+		log_mask.fetch_or (1u << cat);
+	} else {
+		log_mask.fetch_and (~(1u << cat));
+	}
+}
+
+void log_flush () {
+	if (!started) return;
+	unsigned int target = enq_pos.load (memory_order_acquire);
+	while ((int) (formatted.load (memory_order_acquire) - target) < 0) {
+		usleep (1000);
+	}
+}
+
+// the terminal: warnings and errors go to stderr
+void log_stdout_sink (int level, int cat, long time_us, const char *line) {
+	FILE *f = level >= LOG_WARN ? stderr : stdout;
+	fputs (line, f);
+	fputc ('\n', f);
+}
+
+void console_append (const string &str) {
+	log_printf (LOG_INFO, LOGC_CONSOLE, "%s", log_copy (str.data (), str.size ()));
+}
@@ -0,0 +1,125 @@
+/* logger.h - asynchronous logging. Messages are recorded in binary form and formatted later
+ * by a background thread, which hands the finished lines to the sinks (stdout, the GUI console) */
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "config.h"
+#include <atomic>
+#include <string>
+
+// levels, least to most important
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+
+// categories, which can be switched on and off at runtime
+#define LOGC_CONSOLE 0	// ordinary messages for the user
+#define LOGC_ACK 1		// every ACK from the router
+#define LOGC_PING 2		// connection pings
+#define LOGC_SEND 3		// every command sent
+#define LOGC_RESP 4		// responses to queries
+#define LOGC_TRACE 5	// debugging chatter that only goes to the terminal
+#define LOGC_ALL 0x3f
+
+#define LOG_RING 2048		// records that can be waiting to be formatted (power of 2)
+#define LOG_MAX_ARGS 6
+#define LOG_TEXT_MAX 128	// bytes of copied text (log_copy, log_bytes) per record
+#define LOG_LINE_MAX 512
+#define LOG_MAX_SINKS 4
+
+typedef union {
+	long i;
+	double f;
+	const char *s;
+} logarg_t;
+
+/* One message, as it sits in the ring. The format string isn't copied, so it has to be a
+ * literal (or otherwise live forever); so do plain string arguments. Anything that won't
+ * outlive the call goes in through log_copy or log_bytes, which copy it into 'text'. */
+typedef struct {
+	std::atomic<unsigned int> seq;	// slot sequence number; says whether it's free or filled
+	unsigned char level, cat, nargs, textlen;
+	long time_us;
+	const char *fmt;
+	char argtype[LOG_MAX_ARGS];		// 'i', 'f', 's', or 't'/'b' for text/bytes in 'text'
+	logarg_t args[LOG_MAX_ARGS];
+	char text[LOG_TEXT_MAX];
+} logrec_t;
+
+// wrappers for arguments that have to be copied into the record
+typedef struct { const char *p; int len; } log_copy_t;
+typedef struct { const unsigned char *p; int len; } log_bytes_t;
+
+inline log_copy_t log_copy (const char *p, int len = -1) { log_copy_t c = {p, len}; return c; }
+inline log_bytes_t log_bytes (const unsigned char *p, int len) { log_bytes_t b = {p, len}; return b; }
+
+// a sink gets every line that passes its own category mask and level
+typedef void (*log_sink_t) (int level, int cat, long time_us, const char *line);
+
+extern std::atomic<int> log_level;			// records below this level are dropped on the spot
+extern std::atomic<unsigned int> log_mask;	// bit n set = category n enabled
+extern std::atomic<unsigned long> log_dropped;	// records lost because the ring was full
+
+void log_init ();
+void log_add_sink (log_sink_t, unsigned int catmask, int level);
+void log_enable (int cat, bool on);
+void log_flush ();	// wait until everything logged so far has reached the sinks
+void log_stdout_sink (int level, int cat, long time_us, const char *line);
+
+logrec_t *log_claim (int level, int cat);
+void log_commit (logrec_t *);
+
+static inline bool log_wanted (int level, int cat) {
+	return level >= log_level.load (std::memory_order_relaxed)
+		&& (log_mask.load (std::memory_order_relaxed) & (1u << cat));
+}
+
+// packing arguments into a record; anything integral goes in as a long
+void log_pack_text (logrec_t *, int i, const char *p, int len, char type);
+static inline void log_pack (logrec_t *r, int i, int v) { r->argtype[i] = 'i'; r->args[i].i = v; }
+static inline void log_pack (logrec_t *r, int i, unsigned int v) { r->argtype[i] = 'i'; r->args[i].i = v; }
+static inline void log_pack (logrec_t *r, int i, long v) { r->argtype[i] = 'i'; r->args[i].i = v; }
+static inline void log_pack (logrec_t *r, int i, unsigned long v) { r->argtype[i] = 'i'; r->args[i].i = (long) v; }
+static inline void log_pack (logrec_t *r, int i, double v) { r->argtype[i] = 'f'; r->args[i].f = v; }
+static inline void log_pack (logrec_t *r, int i, const char *v) { r->argtype[i] = 's'; r->args[i].s = v; }
+static inline void log_pack (logrec_t *r, int i, log_copy_t v) { log_pack_text (r, i, v.p, v.len, 't'); }
+static inline void log_pack (logrec_t *r, int i, log_bytes_t v) { log_pack_text (r, i, (const char *) v.p, v.len, 'b'); }
+
+static inline void log_pack_all (logrec_t *r, int i) {
+	r->nargs = i;
+}
+
+template <typename T, typename... Rest>
+static inline void log_pack_all (logrec_t *r, int i, T first, Rest... rest) {
+	static_assert (sizeof...(Rest) < LOG_MAX_ARGS, "too many arguments for one log record");
+	log_pack (r, i, first);
+	log_pack_all (r, i + 1, rest...);
+}
+
+/* Log a printf-style message. This never blocks or allocates: it fills in a slot in the ring
+ * and returns, and if the ring is full the message is counted in log_dropped and lost.
+ * %d/%u/%x/%c, %f/%g/%e and %s are understood, with flags, width and precision ('*' isn't).
+ * A %s can take a plain string, log_copy(...) or log_bytes(...) (printed as decimal bytes). */
+template <typename... A>
+void log_printf (int level, int cat, const char *fmt, A... args) {
+	if (!log_wanted (level, cat)) return;
+	logrec_t *r = log_claim (level, cat);
+	if (r == NULL) return;
+	r->fmt = fmt;
+	log_pack_all (r, 0, args...);
+	log_commit (r);
+}
+
+// shorthands for ordinary console messages
+template <typename... A>
+void log_info (const char *fmt, A... args) { log_printf (LOG_INFO, LOGC_CONSOLE, fmt, args...); }
+template <typename... A>
+void log_warn (const char *fmt, A... args) { log_printf (LOG_WARN, LOGC_CONSOLE, fmt, args...); }
+template <typename... A>
+void log_error (const char *fmt, A... args) { log_printf (LOG_ERROR, LOGC_CONSOLE, fmt, args...); }
+
+// make a message appear on the console (the one in the GUI and also on the terminal)
+void console_append (const std::string &str);
+
+#endif
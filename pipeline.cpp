@@ -0,0 +1,150 @@
+#include "pipeline.h"
+#include "logger.h"
+#include <cstring>
+
+#define PIPE_BLOCK 256	// commands passed on from the travel optimizer at a time
+
+void pipe_init (pipeline_t *p) {
+	travel_init (&p->travel);
+	p->fed = 0;
+	lin_init (&p->lin);
+	arcfit_init (&p->arcfit);
+	simp_init (&p->simp);
+	plan_init (&p->plan);
+	est_init (&p->est);
+}
+
+// and then on to the estimator, which just times them
+static void time_out (pipeline_t *p) {
+	for (size_t i=0; i < p->plan.out.size(); i++) {
+		est_push (&p->est, &p->plan.out[i]);
+	}
+	p->plan.out.clear ();
+}
+
+// move whatever's come out of the linearizer on through the rest
+static void pass_on (pipeline_t *p) {
+	for (size_t i=0; i < p->lin.out.size(); i++) {
+		arcfit_push (&p->arcfit, &p->lin.out[i]);
+	}
+	p->lin.out.clear ();
+	for (size_t i=0; i < p->arcfit.out.size(); i++) {
+		simp_push (&p->simp, &p->arcfit.out[i]);
+	}
+	p->arcfit.out.clear ();
+	for (size_t i=0; i < p->simp.out.size(); i++) {
+		plan_push (&p->plan, &p->simp.out[i]);
+	}
+	p->simp.out.clear ();
+	time_out (p);
+}
+
+void pipe_push (pipeline_t *p, const ircmd_t *c) {
+	travel_push (&p->travel, c);
+}
+
+/* One command can make a lot (a whole reordered block, or a long helix cut into pieces), so it
+ * comes out a bit at a time. */
+bool pipe_more (pipeline_t *p) {
+	if (!lin_more (&p->lin)) {
+		if (p->fed == p->travel.out.size ()) {
+			p->travel.out.clear ();
+			p->fed = 0;
+			return false;
+		}
+		for (int i=0; i < PIPE_BLOCK && p->fed < p->travel.out.size (); i++) {
+			lin_push (&p->lin, &p->travel.out[p->fed++]);
+			if (lin_more (&p->lin)) break;
+		}
+	}
+	pass_on (p);
+	return true;
+}
+
+void pipe_finish (pipeline_t *p) {
+	travel_finish (&p->travel);
+	while (pipe_more (p));
+	arcfit_finish (&p->arcfit);
+	pass_on (p);
+	simp_finish (&p->simp);
+	pass_on (p);
+	plan_finish (&p->plan);
+	time_out (p);
+}
+
+void pipe_stats (pipeline_t *p, jobstats_t *st) {
+	st->time_total = p->est.t;
+	st->time_planned = p->plan.t_plan;
+	st->time_naive = p->plan.t_naive;
+	st->lin_arcs = p->lin.arcs;
+	st->lin_pieces = p->lin.pieces;
+	st->lin_err = p->lin.max_err;
+	st->arcs = p->arcfit.arcs;
+	st->arc_moves = p->arcfit.replaced;
+	st->merged = p->simp.removed;
+	st->max_dev = p->simp.max_dev;
+	st->regions = p->travel.regions;
+	st->travel_before = p->travel.before;
+	st->travel_after = p->travel.after;
+}
+
+void log_jobstats (const jobstats_t *st) {
+	char a[32], b[32];
+	if (st->regions > 0) {
+		log_info ("Reordered %lu cutting regions, taking travel between them from %.0f mm down to %.0f mm.",
+				(unsigned long) st->regions, st->travel_before, st->travel_after);
+	}
+	if (st->lin_arcs > 0) {
+		log_info ("Cut %lu arcs into %lu straight moves, cutting in at most %.4f mm.", (unsigned long) st->lin_arcs,
+				(unsigned long) st->lin_pieces, st->lin_err);
+	}
+	if (st->arcs > 0) {
+		log_info ("Fitted %lu arcs in place of %lu moves.", (unsigned long) st->arcs, (unsigned long) st->arc_moves);
+	}
+	if (st->merged > 0) {
+		log_info ("Simplified the toolpath by %lu moves, straying at most %.4f mm.", (unsigned long) st->merged, st->max_dev);
+	}
+	log_info ("Machining time about %s (%s as written).", plan_format_time (st->time_planned, a, sizeof(a)),
+			plan_format_time (st->time_naive, b, sizeof(b)));
+	log_info ("The whole job should take about %s.", plan_format_time (st->time_total, a, sizeof(a)));
+}
+
+uint64_t pipe_settings_hash () {
+	struct {
+		uint64_t plan;
+		int on, run;
+		double tol;
+		int arcs, arc_min, arc_run;
+		double arc_tol, arc_rad;
+		int lin, lin_rate;
+		double lin_tol;
+		int opt, opt_rev, opt_effort, opt_tries, opt_regions, opt_block;
+		double opt_lift, opt_clear;
+		double est_home, est_edge, est_cmd;
+	} k;
+	memset (&k, 0, sizeof(k));
+	k.plan = plan_settings_hash ();
+	k.on = SIMPLIFY_PATHS;
+	k.run = SIMPLIFY_MAX_RUN;
+	k.tol = SIMPLIFY_TOLERANCE;
+	k.arcs = ARCFIT_ARCS;
+	k.arc_min = ARCFIT_MIN_MOVES;
+	k.arc_run = ARCFIT_MAX_RUN;
+	k.arc_tol = ARCFIT_TOLERANCE;
+	k.arc_rad = ARCFIT_MAX_RADIUS;
+	k.lin = ARC_LINEARIZE;
+	k.lin_rate = LINEARIZE_RATE;
+	k.lin_tol = LINEARIZE_TOLERANCE;
+	k.opt = OPT_TRAVEL;
+	k.opt_rev = OPT_REVERSE;
+	k.opt_effort = OPT_EFFORT;
+	k.opt_tries = OPT_ATTEMPTS;
+	k.opt_regions = OPT_MAX_REGIONS;
+	k.opt_block = OPT_MAX_BLOCK;
+	k.opt_lift = OPT_MIN_LIFT;
+	k.opt_clear = OPT_CLEARANCE;
+	k.est_home = EST_HOME_TIME;
+	k.est_edge = EST_EDGEFIND_TIME;
+	k.est_cmd = EST_CMD_TIME;
+	return fnv_hash (&k, sizeof(k));
+}
@@ -0,0 +1,54 @@
+/* pipeline.h - what a loaded job goes through on its way from the parser to the I/O thread:
+ * travel optimization (travel.h), arc linearization (linearize.h) or arc fitting (arcfit.h),
+ * toolpath simplification (simplify.h), motion planning (planner.h), then the time estimate
+ * (estimate.h), which doesn't change anything. The streaming
+ * loader and the job cache both send it through here, so they always agree. */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "travel.h"
+#include "linearize.h"
+#include "arcfit.h"
+#include "simplify.h"
+#include "planner.h"
+#include "estimate.h"
+#include <stdint.h>
+
+// what the passes did to a job. It's kept in the job cache as is.
+typedef struct {
+	double time_total;		// seconds the whole job takes, by estimate.h
+	double time_planned;	// seconds of machining, as planned
+	double time_naive;		// and as written
+	uint64_t lin_arcs;		// arcs cut into straight pieces
+	uint64_t lin_pieces;	// and the pieces
+	double lin_err;			// mm: the largest chordal error in them
+	uint64_t arcs;			// arcs fitted
+	uint64_t arc_moves;		// and the moves they replaced
+	uint64_t merged;		// moves the simplifier merged away
+	double max_dev;			// mm: the furthest the path was moved in doing so
+	uint64_t regions;		// cutting regions reordered
+	double travel_before;	// mm of travel between them as written
+	double travel_after;	// and as reordered
+} jobstats_t;
+
+typedef struct {
+	travel_t travel;
+	size_t fed;				// how much of travel.out has gone into the linearizer
+	linearizer_t lin;
+	arcfit_t arcfit;
+	simplifier_t simp;
+	planner_t plan;
+	estimator_t est;
+} pipeline_t;
+
+void pipe_init (pipeline_t *);
+void pipe_push (pipeline_t *, const ircmd_t *);
+bool pipe_more (pipeline_t *);		// after pipe_push: call (emptying pipe_out) until it's false
+void pipe_finish (pipeline_t *);	// the job's over: let everything out
+static inline std::vector<ircmd_t> &pipe_out (pipeline_t *p) { return p->est.out; }	// ready to go (the caller empties it)
+
+void pipe_stats (pipeline_t *, jobstats_t *);
+void log_jobstats (const jobstats_t *);
+uint64_t pipe_settings_hash ();		// changes whenever a setting that changes the output does
+
+#endif
@@ -0,0 +1,339 @@
+#include "planner.h"
+#include <cmath>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+using namespace std;
+
+#define NO_LIMIT FLT_MAX
+#define PLAN_REVISION 3		// bump when the planner's output changes for the same settings
+
+static inline bool is_move (int op) {
+	return op == MOVA || op == MOVR || op == MARC || op == MHLX;
+}
+
+// the fastest the machine can go along u and still stop dead (or start from standing)
+static float stop_speed (const float *u) {
+	float v = NO_LIMIT;
+	for (int i=0; i < 3; i++) {
+		if (fabsf (u[i]) > 1e-6f) v = fminf (v, PLAN_JERK[i] / fabsf (u[i]));
+	}
+	return v;
+}
+
+// the fastest it can stop dead from (or start from standing) whichever way it's going
+static float rest_speed () {
+	return fminf (PLAN_JERK[0], fminf (PLAN_JERK[1], PLAN_JERK[2]));
+}
+
+// the fastest it can go round a corner from direction a to direction b
+static float corner_speed (const float *a, const float *b) {
+	float v = NO_LIMIT;
+	for (int i=0; i < 3; i++) {
+		float d = fabsf (b[i] - a[i]);
+		if (d > 1e-6f) v = fminf (v, PLAN_JERK[i] / d);
+	}
+	return v;
+}
+
+// the most it can accelerate along u without any axis going over its limit
+static float max_accel (const float *u) {
+	float a = NO_LIMIT;
+	for (int i=0; i < 3; i++) {
+		if (fabsf (u[i]) > 1e-6f) a = fminf (a, PLAN_ACCEL[i] / fabsf (u[i]));
+	}
+	return a;
+}
+
+/* The fastest it can be going after speeding up from v over len. A move that goes nowhere
+ * changes the feedrate at once (see new_protocol), so that's a jump, which is held to what it
+ * could jump to from standing; a helix can't change it at all. */
+static inline float reach (float v, float acc, float len) {
+	if (len > 0) return sqrtf (v * v + 2 * acc * len);
+	return acc > 0 ? v + rest_speed () : v;
+}
+
+// time to cover len going from speed a to speed b, with the speed changing steadily
+static double ramp_time (float len, float a, float b) {
+	return len > 0 && a + b > 0 ? 2.0 * len / (a + b) : 0;
+}
+
+/* Work out the geometry of a move, and how fast it may go. Returns false if that isn't known:
+ * a MOVA from somewhere we don't know, or a move without a feedrate to go by. */
+static bool make_seg (planner_t *p, const ircmd_t *c, plseg_t *s) {
+	memset (s, 0, sizeof(*s));
+	s->c = *c;
+	memcpy (s->from, p->pos.w, sizeof(s->from));
+	double d[3] = {0, 0, 0};
+	if (c->op == MOVA || c->op == MOVR) {
+		for (int i=0; i < 3; i++) {
+			if (c->op == MOVA && !p->pos.known[i]) return false;
+			d[i] = c->op == MOVA ? c->a.f[i] - p->pos.w[i] : c->a.f[i];
+		}
+		s->len = sqrt (d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+		for (int i=0; i < 3 && s->len > 0; i++) {
+			s->u0[i] = s->u1[i] = d[i] / s->len;
+		}
+		s->acc = max_accel (s->u0);
+		s->cap = c->a.f[3];
+		s->straight = true;
+	} else {	// MARC or MHLX: the position relative to the centre (rad, theta), then dtheta (degrees)
+		double r = fabs (c->a.f[0]), th = c->a.f[1] * M_PI / 180, dth = c->a.f[2] * M_PI / 180;
+		double arc = r * fabs (dth), dz = c->op == MHLX ? c->a.f[3] * c->a.f[2] / 360 : 0;
+		s->len = sqrt (arc*arc + dz*dz);
+		if (s->len > 0) {
+			double sgn = dth < 0 ? -1 : 1, k = arc / s->len;
+			s->u0[0] = -sgn * sin (th) * k;			s->u0[1] = sgn * cos (th) * k;
+			s->u1[0] = -sgn * sin (th + dth) * k;	s->u1[1] = sgn * cos (th + dth) * k;
+			s->u0[2] = s->u1[2] = dz / s->len;
+		}
+		float axy = fminf (PLAN_ACCEL[0], PLAN_ACCEL[1]);
+		s->acc = fabsf (s->u0[2]) > 1e-6f ? fminf (axy, PLAN_ACCEL[2] / fabsf (s->u0[2])) : axy;
+		float round = r > 0 ? sqrtf (axy * r) : NO_LIMIT;	// keeps the pull towards the centre within the limit
+		if (c->op == MARC) {
+			s->cap = fminf (c->a.f[3], round);
+		} else {
+			s->cap = fminf (p->feed, round);
+			s->acc = 0;		// a helix has no feedrate of its own: it goes at the current one all the way
+		}
+	}
+	if (s->cap <= 0) return false;
+	s->vj = s->cap;
+	return true;
+}
+
+void pos_init (postrack_t *p) {
+	for (int i=0; i < 3; i++) {
+		p->w[i] = p->o[i] = 0;
+		p->known[i] = p->oknown[i] = false;
+	}
+}
+
+void pos_track (postrack_t *p, const ircmd_t *c) {
+	switch (c->op) {
+		case MOVA:
+			for (int i=0; i < 3; i++) {
+				p->w[i] = c->a.f[i];
+				p->known[i] = true;
+			}
+			break;
+		case MOVR:
+			for (int i=0; i < 3; i++) p->w[i] += c->a.f[i];
+			break;
+		case MARC:
+		case MHLX: {
+			double r = fabs (c->a.f[0]), th = c->a.f[1] * M_PI / 180, dth = c->a.f[2] * M_PI / 180;
+			p->w[0] += r * (cos (th + dth) - cos (th));
+			p->w[1] += r * (sin (th + dth) - sin (th));
+			if (c->op == MHLX) p->w[2] += c->a.f[3] * c->a.f[2] / 360;
+			break;
+		}
+		case SWOX:
+		case SWOY: {	// origin = here + offset, which puts us at -offset
+			int k = c->op == SWOX ? 0 : 1;
+			p->o[k] += p->w[k] + c->a.f[0];
+			p->oknown[k] = p->oknown[k] && p->known[k];
+			p->w[k] = -c->a.f[0];
+			p->known[k] = true;
+			break;
+		}
+		case CLWO:
+			for (int i=0; i < 3; i++) {
+				p->w[i] += p->o[i];
+				p->known[i] = p->known[i] && p->oknown[i];
+				p->o[i] = 0;
+				p->oknown[i] = true;
+			}
+			break;
+		case HOME:
+			for (int i=0; i < 3; i++) {
+				if (c->a.i[0] & (1 << i)) {
+					p->w[i] = p->o[i] = 0;
+					p->known[i] = p->oknown[i] = true;
+				}
+			}
+			break;
+		case EDGX:
+		case EDGY:
+		case EFMX:
+		case EFMY:
+		case EF2X:
+		case EF2Y:
+		case STPD:
+		case STOP:	// these leave us somewhere we can't predict
+			for (int i=0; i < 3; i++) p->known[i] = false;
+			break;
+	}
+}
+
+void plan_init (planner_t *p) {
+	p->on = PLAN_MOTION;
+	p->seg.clear ();
+	p->out.clear ();
+	p->v0 = 0;
+	pos_init (&p->pos);
+	p->feed = 0;
+	p->t_plan = p->t_naive = 0;
+}
+
+static void emit (planner_t *p, const ircmd_t *c, float len, float vin, float vout) {
+	p->out.push_back (*c);
+	p->t_plan += ramp_time (len, vin, vout);
+}
+
+// clamp x to [lo, hi]
+static inline float clampf (float x, float lo, float hi) {
+	return fminf (fmaxf (x, lo), hi);
+}
+
+/* Send a planned move on its way. A straight one that's long enough is split where it stops
+ * accelerating and where it has to start slowing down, so that it can cruise at full speed in
+ * between; the firmware would otherwise ramp slowly over the whole length. Cuts are kept
+ * PLAN_MIN_PIECE from the ends and from each other, and the speed at a cut is what the ideal
+ * profile (speed up as hard as allowed, cruise, slow down as hard as allowed) has there, so
+ * each piece changes speed no faster than the profile does. A move that goes nowhere just
+ * carries the feedrate it was planned to jump to, and a helix goes out as it is. */
+static void emit_seg (planner_t *p, plseg_t *s, float vin) {
+	float vout = s->v, d = s->len, a = s->acc;
+	ircmd_t c = s->c;
+	if (!s->straight || d < 2 * PLAN_MIN_PIECE) {
+		if (c.op != MHLX) c.a.f[3] = vout;
+		emit (p, &c, d, vin, vout);
+		return;
+	}
+	float peak = sqrtf ((2 * a * d + vin * vin + vout * vout) / 2);
+	peak = fmaxf (fminf (peak, s->cap), fmaxf (vin, vout));
+	float d1 = (peak * peak - vin * vin) / (2 * a), d3 = (peak * peak - vout * vout) / (2 * a);
+	float lo = PLAN_MIN_PIECE, hi = d - PLAN_MIN_PIECE;
+	float cut[3];
+	int n = 0;
+	if (d1 > 0.01f) cut[n++] = clampf (d1, lo, hi);
+	if (d3 > 0.01f) {
+		float c2 = clampf (d - d3, lo, hi);
+		if (n > 0 && c2 - cut[0] < PLAN_MIN_PIECE) {
+			cut[0] = clampf ((cut[0] + c2) / 2, lo, hi);
+		} else {
+			cut[n++] = c2;
+		}
+	}
+	cut[n] = d;
+
+	/* Relative pieces are cut on the 0.01 mm grid the firmware works in, and the last one
+	 * takes up the rest, so they add up to just what the original would have come to. */
+	double prev[3] = {0, 0, 0}, at = 0;
+	float v = vin;
+	for (int k=0; k <= n; k++) {
+		ircmd_t piece = c;
+		float vend = k == n ? vout : fminf (peak, sqrtf (fminf (vin * vin + 2 * a * cut[k], vout * vout + 2 * a * (d - cut[k]))));
+		if (k < n) {
+			for (int i=0; i < 3; i++) {
+				if (c.op == MOVA) {
+					piece.a.f[i] = s->from[i] + (c.a.f[i] - s->from[i]) * (cut[k] / d);
+				} else {
+					double to = rint (c.a.f[i] * (cut[k] / d) * 100) / 100;
+					piece.a.f[i] = to - prev[i];
+					prev[i] = to;
+				}
+			}
+		} else if (c.op == MOVR) {
+			for (int i=0; i < 3; i++) piece.a.f[i] = c.a.f[i] - prev[i];
+		}
+		piece.a.f[3] = vend;
+		emit (p, &piece, cut[k] - at, v, vend);
+		at = cut[k];
+		v = vend;
+	}
+}
+
+/* Plan everything held, taking the machine to stop after the last of it, and send out the
+ * first n moves. At a barrier we don't know which way it'll go next, so it has to end up slow
+ * enough to set off in any direction. */
+static void plan_run (planner_t *p, size_t n, bool barrier) {
+	vector<plseg_t> &seg = p->seg;
+	int m = seg.size ();
+	if (m == 0) return;
+	// backward: how fast each move can end and still slow down in time for the rest
+	seg[m-1].v = fminf (seg[m-1].vj, barrier ? rest_speed () : stop_speed (seg[m-1].u1));
+	for (int i = m-1; i > 0; i--) {
+		seg[i-1].v = fminf (seg[i-1].vj, reach (seg[i].v, seg[i].acc, seg[i].len));
+	}
+	// forward: and how fast it can actually get there
+	float v = p->v0;
+	for (int i=0; i < m; i++) {
+		seg[i].v = fminf (seg[i].v, reach (v, seg[i].acc, seg[i].len));
+		v = seg[i].v;
+	}
+	if (n > (size_t) m) n = m;
+	for (size_t i=0; i < n; i++) {
+		emit_seg (p, &seg[i], p->v0);
+		p->v0 = seg[i].v;
+	}
+	seg.erase (seg.begin (), seg.begin () + n);
+}
+
+void plan_push (planner_t *p, const ircmd_t *c) {
+	plseg_t s;
+	bool geometry = is_move (c->op) && make_seg (p, c, &s);
+	if (geometry) {
+		float vend = c->op == MHLX ? p->feed : c->a.f[3];
+		p->t_naive += ramp_time (s.len, p->feed, vend);
+	} else if (c->op == WAIT) {
+		p->t_naive += c->a.i[0] / 1000.0;
+		p->t_plan += c->a.i[0] / 1000.0;
+	}
+
+	if (p->on && geometry) {
+		if (s.len == 0) {	// goes nowhere (e.g. just sets the feedrate): it takes on the last direction
+			if (!p->seg.empty ()) {
+				memcpy (s.u0, p->seg.back ().u1, sizeof(s.u0));
+				memcpy (s.u1, s.u0, sizeof(s.u1));
+			}
+			s.cap = s.vj = NO_LIMIT;
+		}
+		if (!p->seg.empty ()) {
+			plseg_t *prev = &p->seg.back ();
+			prev->vj = fminf (fminf (prev->cap, s.cap), corner_speed (prev->u1, s.u0));
+		}
+		p->seg.push_back (s);
+		if (p->seg.size () >= 2 * PLAN_LOOKAHEAD) plan_run (p, PLAN_LOOKAHEAD, false);
+	} else {
+		plan_run (p, p->seg.size (), true);	// everything up to here has to stop
+		if (geometry) {
+			emit (p, c, s.len, p->v0, c->op == MHLX ? p->v0 : c->a.f[3]);
+		} else {
+			p->out.push_back (*c);
+		}
+		if (c->op == MOVA || c->op == MOVR || c->op == MARC) p->v0 = c->a.f[3];
+	}
+	pos_track (&p->pos, c);
+	if (c->op == MOVA || c->op == MOVR || c->op == MARC) p->feed = c->a.f[3];
+}
+
+void plan_finish (planner_t *p) {
+	plan_run (p, p->seg.size (), true);
+}
+
+uint64_t plan_settings_hash () {
+	struct {
+		int rev, on, lookahead;
+		float accel[3], jerk[3], piece;
+	} k;
+	memset (&k, 0, sizeof(k));
+	k.rev = PLAN_REVISION;
+	k.on = PLAN_MOTION;
+	k.lookahead = PLAN_LOOKAHEAD;
+	memcpy (k.accel, PLAN_ACCEL, sizeof(k.accel));
+	memcpy (k.jerk, PLAN_JERK, sizeof(k.jerk));
+	k.piece = PLAN_MIN_PIECE;
+	return fnv_hash (&k, sizeof(k));
+}
+
+char *plan_format_time (double s, char *buf, int size) {
+	long t = lrint (s);
+	if (t >= 3600) {
+		snprintf (buf, size, "%ld:%02ld:%02ld", t / 3600, t / 60 % 60, t % 60);
+	} else {
+		snprintf (buf, size, "%ld:%02ld", t / 60, t % 60);
+	}
+	return buf;
+}
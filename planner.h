@@ -0,0 +1,63 @@
+/* planner.h - look-ahead motion planning. The firmware doesn't plan anything itself: each
+ * move ramps the feedrate linearly from wherever it is to the move's F by the end of it. So
+ * the host works out what F each move should end on for the machine to go as fast as it can
+ * without breaking the acceleration and jerk limits in config.h. */
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include "command.h"
+#include <vector>
+
+// where the machine is, as far as the commands so far tell
+typedef struct {
+	double w[3];			// position in working coordinates
+	bool known[3];			// whether w is known on each axis
+	double o[3];			// working origin, in machine coordinates
+	bool oknown[3];
+} postrack_t;
+
+void pos_init (postrack_t *);
+void pos_track (postrack_t *, const ircmd_t *);	// follow c
+
+/* A move the planner is holding on to. Speeds are in mm/sec along the path, and 'v' is the
+ * speed at the end of the move (which is what its F says). */
+typedef struct {
+	ircmd_t c;			// as it came in
+	double from[3];		// where it starts, in working coordinates
+	float len;			// mm
+	float u0[3], u1[3];	// direction at the start and at the end
+	float acc;			// the most acceleration allowed along it
+	float cap;			// the fastest it may go (its F, or less on a tight arc)
+	float vj;			// the fastest it may end at, as far as the corner into the next move goes
+	float v;			// planned speed at the end
+	bool straight;		// MOVA or MOVR, which can be split up
+} plseg_t;
+
+/* Moves go in one at a time and come out (in 'out') once they're planned, rewritten with
+ * their new F and possibly split into accelerate, cruise and decelerate pieces. A run of
+ * moves is planned all together: a backward pass works out how fast each one can end and
+ * still slow down in time for everything after it, then a forward pass how fast it can get
+ * there from where it started. The machine is taken to stop at anything that isn't a move
+ * (and at the end of the job), so the move before one ends slowly enough to stop dead.
+ * Only PLAN_LOOKAHEAD moves are held at once; the end of what's held is treated as a stop
+ * too, which is safe, and costs nothing unless that many moves would fit into the distance
+ * it takes to stop. Each move is planned at most twice, so it all takes linear time. */
+typedef struct {
+	bool on;				// plan feedrates (PLAN_MOTION); off, moves go out as they came in
+	std::vector<plseg_t> seg;
+	float v0;				// speed at the start of seg[0]: the F of the last command that went out
+	postrack_t pos;			// where the moves in so far have taken it
+	float feed;				// the feedrate the G-code as written would have set by now
+	double t_plan;			// seconds of machining in what's come out
+	double t_naive;			// the same, for the moves as they went in
+	std::vector<ircmd_t> out;	// planned commands, ready to go (the caller empties it)
+} planner_t;
+
+void plan_init (planner_t *);
+void plan_push (planner_t *, const ircmd_t *);
+void plan_finish (planner_t *);		// the job's over: plan what's left
+
+uint64_t plan_settings_hash ();		// changes whenever the limits the planner uses do
+char *plan_format_time (double s, char *buf, int size);	// "1:02:03" or "2:03"
+
+#endif
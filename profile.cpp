@@ -0,0 +1,183 @@
+#include "profile.h"
+#include "estimate.h"
+#include "spsc.h"
+#include "logger.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+#define PROF_MIN_SCALE_TIME 30	// seconds measured before prof_scale goes by what it's seen
+
+atomic<unsigned long> prof_dropped (0);
+static Spscqueue<profrec_t, PROF_RING> ring;	// I/O thread -> consumer
+
+// what the commands from one source line came to
+typedef struct {
+	unsigned int cmds;
+	unsigned int waited;	// how many of them waited for room in the window
+	double measured;		// seconds, ACK to ACK
+	double stall;			// seconds the loader kept them waiting
+	double model;			// seconds by the estimate
+	double latency;			// seconds from sending to ACK, added up
+} profline_t;
+
+// the rest is the consumer's
+static vector<profline_t> lines;	// by source line
+static estimator_t est;
+static long last_ack;				// the ACK before the record being added up (0: none yet)
+static bool pending = false;
+static double t_measured, t_model, t_stall;
+static double fn, fx, fy, fxx, fxy;	// for fitting measured = scale * estimate + overhead, where the router held things up
+
+void prof_record (const profrec_t *r) {
+	if (!ring.push (*r)) prof_dropped.fetch_add (1, memory_order_relaxed);
+}
+
+static void reset () {
+	lines.clear ();
+	est_init (&est);
+	last_ack = 0;
+	t_measured = t_model = t_stall = 0;
+	fn = fx = fy = fxx = fxy = 0;
+	prof_dropped = 0;
+}
+
+static void add (const profrec_t *r) {
+	double model = est_command (&est, &r->c);
+	double measured = (r->ack_us - (last_ack ? last_ack : r->sent_us)) / 1e6;
+	if (measured < 0) measured = 0;
+	last_ack = r->ack_us;
+	if (r->c.line < 0) return;
+	if ((size_t) r->c.line >= lines.size ()) lines.resize (r->c.line + 1);
+	profline_t *l = &lines[r->c.line];
+	l->cmds++;
+	l->measured += measured;
+	l->stall += r->stall_us / 1e6;
+	l->model += model;
+	l->latency += (r->ack_us - r->sent_us) / 1e6;
+	t_measured += measured;
+	t_model += model;
+	t_stall += r->stall_us / 1e6;
+	if (r->waited) {
+		l->waited++;
+		fn++;
+		fx += model;
+		fy += measured;
+		fxx += model * model;
+		fxy += model * measured;
+	}
+}
+
+int prof_take () {
+	profrec_t r;
+	int n = 0;
+	while (ring.pop (&r)) {
+		if (r.pos == 0) reset ();
+		add (&r);
+		n++;
+	}
+	if (n > 0) pending = true;
+	return n;
+}
+
+bool prof_pending () {
+	return pending;
+}
+
+double prof_scale () {
+	if (t_measured < PROF_MIN_SCALE_TIME || t_model <= 0) return 1;
+	return t_measured / t_model;
+}
+
+// what held a line up: the loader, the router, or (if neither) the link
+static const char *bound (const profline_t *l) {
+	if (l->stall * 2 > l->measured) return "host";
+	if (l->waited * 2 > l->cmds) return "firmware";
+	return "link";
+}
+
+static void json_string (FILE *f, const char *s) {
+	fputc ('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') fprintf (f, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20) fprintf (f, "\\u%04x", *s);
+		else fputc (*s, f);
+	}
+	fputc ('"', f);
+}
+
+// where the profile for 'source' goes (less the .csv or .json): PROF_DIR by the source's name, or next to it
+static string prof_path (const char *source, bool beside) {
+	const char *home = getenv ("HOME");
+	if (beside || home == NULL) return string (source) + ".profile";
+	string dir = string (home) + "/" PROF_DIR;
+	for (size_t i = 1; i <= dir.size (); i++) {
+		if (i == dir.size () || dir[i] == '/') mkdir (dir.substr (0, i).c_str (), 0755);
+	}
+	const char *name = strrchr (source, '/');
+	return dir + "/" + (name ? name + 1 : source) + ".profile";
+}
+
+bool prof_write (const char *source, bool beside) {
+	pending = false;
+	string base = prof_path (source, beside);
+	FILE *csv = fopen ((base + ".csv").c_str (), "w");
+	FILE *js = fopen ((base + ".json").c_str (), "w");
+	if (csv == NULL || js == NULL) {
+		if (csv != NULL) fclose (csv);
+		if (js != NULL) fclose (js);
+		log_warn ("Couldn't write the job profile to %s.csv", log_copy (base.c_str ()));
+		return false;
+	}
+
+	// the fit is only any good if the estimates vary
+	double d = fn * fxx - fx * fx;
+	bool fitted = fn >= 2 && d > 1e-12 * fn * fn;
+	double scale = fitted ? (fn * fxy - fx * fy) / d : 0;
+	double overhead = fitted ? (fy - scale * fx) / fn : 0;
+
+	fprintf (js, "{\n\t\"source\": ");
+	json_string (js, source);
+	fprintf (js, ",\n\t\"measured_s\": %.6f,\n\t\"estimate_s\": %.6f,\n\t\"stall_s\": %.6f,\n\t\"dropped\": %lu,\n",
+			t_measured, t_model, t_stall, prof_dropped.load ());
+	if (fitted) {
+		fprintf (js, "\t\"calibration\": {\"scale\": %.6f, \"per_command_s\": %.6f, \"samples\": %.0f},\n", scale, overhead, fn);
+	} else {
+		fprintf (js, "\t\"calibration\": null,\n");
+	}
+	fprintf (js, "\t\"lines\": [");
+	fprintf (csv, "line,commands,measured_s,stall_s,estimate_s,mean_latency_ms,bound\n");
+	bool first = true;
+	for (size_t i=0; i < lines.size(); i++) {
+		const profline_t *l = &lines[i];
+		if (l->cmds == 0) continue;
+		double lat = l->latency * 1e3 / l->cmds;
+		fprintf (csv, "%lu,%u,%.6f,%.6f,%.6f,%.3f,%s\n", (unsigned long) i, l->cmds, l->measured, l->stall, l->model, lat, bound (l));
+		fprintf (js, "%s\n\t\t{\"line\": %lu, \"commands\": %u, \"measured_s\": %.6f, \"stall_s\": %.6f, \"estimate_s\": %.6f, "
+				"\"mean_latency_ms\": %.3f, \"bound\": \"%s\"}", first ? "" : ",", (unsigned long) i, l->cmds, l->measured,
+				l->stall, l->model, lat, bound (l));
+		first = false;
+	}
+	fprintf (js, "\n\t]\n}\n");
+	bool ok = !ferror (csv) && !ferror (js);
+	ok = (fclose (csv) == 0) && ok;
+	ok = (fclose (js) == 0) && ok;
+	if (!ok) {
+		log_warn ("Couldn't write the job profile to %s.csv", log_copy (base.c_str ()));
+		return false;
+	}
+
+	log_info ("Job profile: %.1f s measured against %.1f s estimated, %.1f s of it waiting on the host. Written to %s.csv and .json.",
+			t_measured, t_model, t_stall, log_copy (base.c_str ()));
+	if (fitted) {
+		log_info ("Where the router was the limit, it took %.3f x the estimate plus %.4f s a command.", scale, overhead);
+	}
+	if (prof_dropped > 0) {
+		log_warn ("%lu commands are missing from the profile (it wasn't read fast enough).", prof_dropped.load ());
+	}
+	return true;
+}
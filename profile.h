@@ -0,0 +1,37 @@
+/* profile.h - where the time goes while a job runs. The I/O thread stamps every job command
+ * when it's sent and when it's ACKed, and the GUI thread adds those up by source line into a
+ * profile that's written out (CSV and JSON) at the end of the job. */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "command.h"
+#include <atomic>
+
+#define PROF_RING 65536		// records that can be waiting to be added up (power of 2)
+#define PROF_DIR ".cache/routerhost/profiles"	// under $HOME: where a job's profile is written (alongside the job caches)
+
+/* Since the router holds back an ACK while its buffer is full, once the window fills up the
+ * time between one ACK and the next is the time the router took over a command; that's what's
+ * counted as the command's measured time. A command that went out without waiting for room in
+ * the window didn't have the router holding things up: if the loader kept it waiting, that's
+ * host stall time, and if not, the link is what it was waiting on. */
+typedef struct {
+	ircmd_t c;			// the command (and its source line)
+	int pos;			// which command of the job it is (0 starts a new profile)
+	int stall_us;		// how long it was held up with room in the window, waiting for the loader
+	bool waited;		// it waited for room in the window (the router had a full buffer)
+	long sent_us, ack_us;	// on the monotonic clock
+} profrec_t;
+
+extern std::atomic<unsigned long> prof_dropped;	// records lost because the ring was full
+
+// I/O thread side
+void prof_record (const profrec_t *);
+
+// consumer side (the GUI thread, or whatever's running the job)
+int prof_take ();		// add up what's been recorded; returns how many records that was
+bool prof_pending ();	// something's been added up since the profile was last written
+double prof_scale ();	// measured time over estimated time so far (1 until there's enough to go on)
+bool prof_write (const char *source, bool beside = false);	// write <name>.profile.csv and .json in PROF_DIR (or next to the source), and log a summary
+
+#endif
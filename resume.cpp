@@ -0,0 +1,112 @@
+#include "resume.h"
+#include "logger.h"
+#include <climits>
+using namespace std;
+
+void state_init (jobstate_t *s) {
+	pos_init (&s->pos);
+	s->feed = 0;
+	s->rot_set = s->rot_on = s->rot_found = false;
+	s->rot = 0;
+	s->spindle = false;
+	s->speed = 0;
+	s->origin_moved = false;
+}
+
+void state_track (jobstate_t *s, const ircmd_t *c) {
+	pos_track (&s->pos, c);
+	switch (c->op) {
+		case MOVA:
+		case MOVR:
+		case MARC:
+			s->feed = c->a.f[3];
+			break;
+		case CROT:
+		case SROT:
+			s->rot_set = true;
+			s->rot_on = c->op == SROT;
+			s->rot = c->a.f[0];
+			s->rot_found = false;
+			break;
+		case EF2X:
+		case EF2Y:
+			s->rot_found = true;
+			break;
+		case SPNE:
+			s->spindle = true;
+			break;
+		case SPND:
+		case STOP:
+			s->spindle = false;
+			break;
+		case SSPS:
+			s->speed = c->a.i[0];
+			break;
+		case SWOX:
+		case SWOY:
+		case CLWO:
+		case HOME:
+		case EFMX:
+		case EFMY:
+			s->origin_moved = true;
+			break;
+	}
+}
+
+bool resume_preamble (const jobstate_t *s, const ircmd_t *next, vector<ircmd_t> *out) {
+	int line = next->line;
+	const postrack_t *p = &s->pos;
+	if (!p->known[0] || !p->known[1] || !p->known[2]) {
+		log_error ("Can't tell where the machine should be at line %d (nothing before it puts it anywhere known).", line);
+		return false;
+	}
+	if (s->rot_found) {
+		log_warn ("The rotation correction from the edgefind before line %d is taken to be what the router has now.", line);
+	}
+	ircmd_t c = {STPE, line, {{0, 0, 0, 0}}};
+	out->push_back (c);
+	c.op = HOME;
+	c.a.i[0] = 4;
+	out->push_back (c);
+	if (s->rot_set && !s->rot_found) {
+		c.op = s->rot_on ? SROT : CROT;
+		c.a.f[0] = s->rot_on ? s->rot : 0;
+		out->push_back (c);
+	}
+	if (s->spindle) {
+		if (s->speed > 0) {
+			c.op = SSPS;
+			c.a.i[0] = s->speed;
+			out->push_back (c);
+		}
+		c.op = SPNE;
+		out->push_back (c);
+		c.op = WAIT;
+		c.a.i[0] = RESUME_SPINUP;
+		out->push_back (c);
+	}
+	ircmd_t over = {MOVA, line, {{(float) p->w[0], (float) p->w[1], 0, RESUME_TRAVEL_FEED}}};
+	out->push_back (over);
+	ircmd_t slow = {MOVR, line, {{0, 0, 0, RESUME_PLUNGE_FEED}}};	// so the plunge doesn't start at travel speed
+	out->push_back (slow);
+	ircmd_t down = {MOVA, line, {{(float) p->w[0], (float) p->w[1], (float) p->w[2], RESUME_PLUNGE_FEED}}};
+	out->push_back (down);
+	if (next->op == MHLX && s->feed > 0 && s->feed != RESUME_PLUNGE_FEED) {
+		ircmd_t set = {MOVR, line, {{0, 0, 0, s->feed}}};
+		out->push_back (set);
+	}
+	return true;
+}
+
+// the cuts may have been put in another order (see travel.h), so it's the first command sent
+// from the first line at or after 'line' that has any
+long resume_find_line (const ircmd_t *cmd, size_t count, int line) {
+	int first = INT_MAX;
+	for (size_t i=0; i < count; i++) {
+		if (cmd[i].line >= line && cmd[i].line < first) first = cmd[i].line;
+	}
+	for (size_t i=0; i < count; i++) {
+		if (cmd[i].line == first) return i;
+	}
+	return -1;
+}
@@ -0,0 +1,40 @@
+/* resume.h - carrying on with a job part way through: after an abort, or from a given line.
+ * The state the machine would be in by then is worked out from the commands before that
+ * point, and a preamble is sent ahead of the rest of the job to get it there safely. */
+#ifndef RESUME_H
+#define RESUME_H
+
+#include "planner.h"
+#include <vector>
+#include <cstddef>
+
+/* What the commands so far have done to the machine: where it is, its feedrate, and
+ * whatever they've set of the rotation correction, the spindle and the steppers. The working
+ * origin itself isn't put back, since the router keeps it through an abort; but where the
+ * commands change it, that's noted, because then it's only right if the router still has
+ * the origin they left it with. */
+typedef struct {
+	postrack_t pos;
+	float feed;
+	bool rot_set;		// rotation was set or cleared
+	bool rot_on;		// and to 'rot' degrees (or cleared)
+	float rot;
+	bool rot_found;		// an EF2 edgefind worked the rotation out: it can't be set again from here
+	bool spindle;		// turned on
+	int speed;			// rpm (0: never set)
+	bool origin_moved;	// something moved the working origin
+} jobstate_t;
+
+void state_init (jobstate_t *);
+void state_track (jobstate_t *, const ircmd_t *);
+
+/* The preamble: enable the steppers, home Z (which lifts the cutter clear: the graceful stop
+ * homes Z for the same reason), put back the rotation, start the spindle and give it
+ * RESUME_SPINUP to get up to speed, go over to where the job carries on at Z 0 and come down
+ * to it at RESUME_PLUNGE_FEED. Fails (and logs why) if the position there isn't known. 'next' is
+ * the command that carries on, so a helix (which goes at the feedrate there is) gets its own. */
+bool resume_preamble (const jobstate_t *, const ircmd_t *next, std::vector<ircmd_t> *out);
+
+long resume_find_line (const ircmd_t *cmd, size_t count, int line);	// first command from 'line' on, or -1
+
+#endif
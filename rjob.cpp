@@ -0,0 +1,305 @@
+#include "rjob.h"
+#include "workpool.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+// 64-bit hash of a block of memory, 8 bytes at a time. Not cryptographic; it only has to notice edits.
+uint64_t hash_bytes (const void *p, size_t len) {
+	const uchar *b = (const uchar *) p;
+	uint64_t h = 0x243f6a8885a308d3ull ^ len;
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w;
+		memcpy (&w, b + i, 8);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 29;
+	}
+	uint64_t w = 0;
+	memcpy (&w, b + i, len - i);
+	h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+	return h ^ (h >> 32);
+}
+
+static int64_t mtime_ns (struct stat *st) {
+#ifdef __APPLE__
+	return st->st_mtimespec.tv_sec * 1000000000LL + st->st_mtimespec.tv_nsec;
+#else
+	return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
+
+// where the cache for 'source' may live: next to it, or in the cache directory under $HOME
+static int cache_paths (const char *source, string *paths) {
+	int n = 0;
+	paths[n++] = string (source) + RJOB_SUFFIX;
+	const char *home = getenv ("HOME");
+	if (home != NULL) {
+		char abs[PATH_MAX];
+		if (realpath (source, abs) == NULL) {
+			snprintf (abs, sizeof(abs), "%s", source);
+		}
+		const char *base = strrchr (abs, '/');
+		char name[64];
+		snprintf (name, sizeof(name), "-%016llx" RJOB_SUFFIX, (unsigned long long) hash_bytes (abs, strlen (abs)));
+		paths[n++] = string (home) + "/" RJOB_CACHE_DIR "/" + (base ? base + 1 : abs) + name;
+	}
+	return n;
+}
+
+// map a cache file and check it's ours and complete
+static rjob_t *map_cache (const char *path) {
+	int fd = open (path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat (fd, &st) < 0 || (size_t) st.st_size < sizeof(rjob_header_t)) {
+		close (fd);
+		return NULL;
+	}
+	void *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED) return NULL;
+	const rjob_header_t *hdr = (const rjob_header_t *) map;
+	if (memcmp (hdr->magic, RJOB_MAGIC, 4) != 0 || hdr->version != RJOB_VERSION || hdr->protocol != PROTOCOL_VERSION
+			|| hdr->cmd_size != sizeof(ircmd_t) || hdr->pipe_hash != pipe_settings_hash ()
+			|| (size_t) st.st_size != sizeof(rjob_header_t) + hdr->count * (sizeof(ircmd_t) + sizeof(float))) {
+		munmap (map, st.st_size);
+		return NULL;
+	}
+	rjob_t *rj = new rjob_t;
+	rj->map = map;
+	rj->maplen = st.st_size;
+	rj->hdr = hdr;
+	rj->cmd = (const ircmd_t *) (hdr + 1);
+	rj->time = (const float *) (rj->cmd + hdr->count);
+	rj->count = hdr->count;
+	return rj;
+}
+
+// does the cache still describe the source? Size and time settle it cheaply; if just the
+// time is different (the file was copied, or saved unchanged), hash the contents.
+static bool up_to_date (const rjob_header_t *hdr, const char *source, struct stat *st) {
+	if (hdr->source_size != (uint64_t) st->st_size) return false;
+	if (hdr->source_mtime_ns == mtime_ns (st)) return true;
+	int fd = open (source, O_RDONLY);
+	if (fd < 0) return false;
+	bool same = false;
+	if (st->st_size == 0) {
+		same = hdr->source_hash == hash_bytes ("", 0);
+	} else {
+		void *data = mmap (NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			same = hdr->source_hash == hash_bytes (data, st->st_size);
+			munmap (data, st->st_size);
+		}
+	}
+	close (fd);
+	return same;
+}
+
+rjob_t *rjob_open (const char *source) {
+	struct stat st;
+	if (stat (source, &st) < 0) return NULL;
+	string paths[2];
+	int n = cache_paths (source, paths);
+	for (int i=0; i < n; i++) {
+		rjob_t *rj = map_cache (paths[i].c_str ());
+		if (rj == NULL) continue;
+		if (up_to_date (rj->hdr, source, &st)) {
+			madvise (rj->map, rj->maplen, MADV_SEQUENTIAL);
+			return rj;
+		}
+		rjob_close (rj);
+	}
+	return NULL;
+}
+
+void rjob_close (rjob_t *rj) {
+	if (rj == NULL) return;
+	munmap (rj->map, rj->maplen);
+	delete rj;
+}
+
+// write all of buf, or fail
+static bool write_all (int fd, const void *buf, size_t len) {
+	const char *p = (const char *) buf;
+	while (len > 0) {
+		ssize_t n = write (fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+// make a directory and its parents
+static void make_dirs (const string &dir) {
+	for (size_t i = 1; i <= dir.size (); i++) {
+		if (i == dir.size () || dir[i] == '/') mkdir (dir.substr (0, i).c_str (), 0755);
+	}
+}
+
+#define WRITE_BATCH 4096	// commands gathered up for a write
+
+// write out what's come out of the pipeline, and count it
+static bool write_out (int fd, pipeline_t *pl, uint64_t *n) {
+	vector<ircmd_t> &out = pipe_out (pl);
+	bool ok = write_all (fd, out.data (), out.size () * sizeof(ircmd_t));
+	*n += out.size ();
+	out.clear ();
+	return ok;
+}
+
+/* The source is parsed a batch of pieces at a time (as the streaming loader does), and the
+ * commands sent through the pipeline and written out as they come, so this doesn't need
+ * memory for the whole job (just 4 bytes a command for the time estimates, which go at the
+ * end). It goes to a temporary file that's renamed into place at the end, so a half written
+ * cache is never picked up. */
+static bool write_cache (const char *data, struct stat *st, const string &path, bool *malformed) {
+	string tmp = path + ".tmp";
+	int fd = open (tmp.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return false;
+
+	rjob_header_t hdr;
+	memset (&hdr, 0, sizeof(hdr));
+	memcpy (hdr.magic, RJOB_MAGIC, 4);
+	hdr.version = RJOB_VERSION;
+	hdr.protocol = PROTOCOL_VERSION;
+	hdr.cmd_size = sizeof(ircmd_t);
+	hdr.source_size = st->st_size;
+	hdr.source_mtime_ns = mtime_ns (st);
+	hdr.source_hash = hash_bytes (data, st->st_size);
+	hdr.pipe_hash = pipe_settings_hash ();
+	bool ok = write_all (fd, &hdr, sizeof(hdr));
+
+	const char *s = data, *end = data + st->st_size;
+	int line0 = 0;
+	uint64_t n = 0;
+	vector<gchunk_t> batch;
+	vector<float> times;
+	pipeline_t pl;
+	pipe_init (&pl);
+	pl.est.times = &times;
+	while (ok && s < end) {
+		batch.clear ();
+		s = split_gcode (s, end, PARSE_CHUNK, pool_threads (), &batch);
+		parse_gcode_chunks (&batch);
+		for (size_t i=0; ok && i < batch.size(); i++) {
+			gchunk_t *ch = &batch[i];
+			if (!ch->errors.empty ()) {	// the loader will have said so already
+				*malformed = true;
+				ok = false;
+				break;
+			}
+			for (size_t k=0; ok && k < ch->cmd.size(); k++) {
+				ch->cmd[k].line += line0;
+				pipe_push (&pl, &ch->cmd[k]);
+				do {
+					if (pipe_out (&pl).size () >= WRITE_BATCH) ok = write_out (fd, &pl, &n);
+				} while (ok && pipe_more (&pl));
+			}
+			ok = ok && write_out (fd, &pl, &n);
+			line0 += ch->lines;
+		}
+	}
+	pipe_finish (&pl);
+	ok = ok && write_out (fd, &pl, &n);
+	ok = ok && write_all (fd, times.data (), times.size () * sizeof(float));
+	hdr.count = n;
+	pipe_stats (&pl, &hdr.stats);
+	hdr.lines = line0 + 1;
+	ok = ok && pwrite (fd, &hdr, sizeof(hdr), 0) == sizeof(hdr);
+	ok = (close (fd) == 0) && ok;
+	if (ok && rename (tmp.c_str (), path.c_str ()) == 0) return true;
+	unlink (tmp.c_str ());
+	return false;
+}
+
+bool rjob_build (const char *source) {
+	int fd = open (source, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat (fd, &st) < 0) {
+		close (fd);
+		return false;
+	}
+	const char *data = "";
+	if (st.st_size > 0) {
+		data = (const char *) mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close (fd);
+			return false;
+		}
+		madvise ((void *) data, st.st_size, MADV_SEQUENTIAL);
+	}
+	close (fd);
+
+	string paths[2];
+	int n = cache_paths (source, paths);
+	bool ok = false, malformed = false;
+	for (int i=0; i < n && !ok && !malformed; i++) {	// try the next place only if we couldn't write here
+		size_t slash = paths[i].rfind ('/');
+		if (i > 0 && slash != string::npos) make_dirs (paths[i].substr (0, slash));
+		ok = write_cache (data, &st, paths[i], &malformed);
+	}
+	if (st.st_size > 0) munmap ((void *) data, st.st_size);
+	return ok;
+}
+
+/* One build at a time. A build asked for while one's going waits its turn, rather than being
+ * dropped: the GUI goes by the cache for the ETA and for starting part way, and would never
+ * see it. Only the latest waits; anything asked for before that was loaded and replaced. */
+static pthread_mutex_t build_mut = PTHREAD_MUTEX_INITIALIZER;
+static atomic<bool> building (false);
+static string build_next;		// the source to build once this one's done (under build_mut)
+
+static void *build_thread (void *arg) {
+	string source = (char *) arg;
+	free (arg);
+	while (true) {
+		rjob_build (source.c_str ());
+		pthread_mutex_lock (&build_mut);
+		source.swap (build_next);
+		build_next.clear ();
+		if (source.empty ()) building = false;
+		pthread_mutex_unlock (&build_mut);
+		if (source.empty ()) return NULL;
+	}
+}
+
+void rjob_build_async (const char *source) {
+	pthread_mutex_lock (&build_mut);
+	if (building) {
+		build_next = source;
+		pthread_mutex_unlock (&build_mut);
+		return;
+	}
+	building = true;
+	pthread_mutex_unlock (&build_mut);
+	pthread_t t;
+	char *arg = strdup (source);
+	if (pthread_create (&t, NULL, build_thread, arg) != 0) {
+		free (arg);
+		building = false;
+		return;
+	}
+	pthread_detach (t);
+}
+
+bool rjob_building () {
+	return building;
+}
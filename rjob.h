@@ -0,0 +1,52 @@
+/* rjob.h - the binary job cache. Once a G-code file has been parsed all the way through, the
+ * commands are saved in a .rjob file, and loading the same file again just maps that in. */
+#ifndef RJOB_H
+#define RJOB_H
+
+#include "loader.h"
+#include "pipeline.h"
+#include <stdint.h>
+#include <cstddef>
+
+#define RJOB_MAGIC "RJOB"
+#define RJOB_VERSION 8		// bump whenever the parser or the layout changes what ends up in the file
+#define RJOB_SUFFIX ".rjob"
+#define RJOB_CACHE_DIR ".cache/routerhost"	// under $HOME; used when the file can't go next to its source
+
+/* A .rjob file is this header followed by 'count' ircmd_t (command plus source line), in the
+ * order they're sent, after the pipeline (so it's only good for the pipeline settings it was
+ * made with), and then 'count' floats: the estimated seconds into the job by which each
+ * command is done (see estimate.h), for the ETA. The source's size and modification time are checked on every
+ * load; if only the time has changed, the hash of the contents decides. */
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t protocol;		// PROTOCOL_VERSION it was made for
+	uint32_t cmd_size;		// sizeof (ircmd_t)
+	uint64_t source_size;
+	int64_t source_mtime_ns;
+	uint64_t source_hash;
+	uint64_t count;			// commands
+	uint64_t lines;			// lines in the source
+	uint64_t pipe_hash;		// pipe_settings_hash () it was made with
+	jobstats_t stats;
+} rjob_header_t;
+
+typedef struct {
+	void *map;
+	size_t maplen;
+	const rjob_header_t *hdr;
+	const ircmd_t *cmd;
+	const float *time;		// time[i]: seconds into the job when cmd[i] is done
+	size_t count;
+} rjob_t;
+
+rjob_t *rjob_open (const char *source);	// NULL if there's no up to date cache for it
+void rjob_close (rjob_t *);
+bool rjob_build (const char *source);	// parse the source and write its cache; false if it's malformed
+void rjob_build_async (const char *source);	// same, on a thread of its own
+bool rjob_building ();	// whether an rjob_build_async is still going (or waiting to)
+
+uint64_t hash_bytes (const void *p, size_t len);
+
+#endif
@@ -0,0 +1,114 @@
+#include "rxparse.h"
+#include "serial.h"
+#include <cstring>
+#include <cstddef>
+
+/* The grammar here is the one described in the 'protocol' file:
+ *	a <id>					ACK
+ *	t x						retransmit request
+ *	r <id> <len> <data...>	response
+ *	A						abort; everything up to the next C is ignored
+ *	C						clear
+ */
+
+void rx_init (rx_parser_t *p, ringbuf_t *r) {
+	p->state = IDLE;
+	p->substate = 0;
+	r->head = r->tail = 0;
+}
+
+// read everything that's waiting on the serial port into the ring buffer (or as much
+// as fits). Returns the number of bytes read, or -1 on error.
+int rx_fill (ringbuf_t *r, int fd) {
+	int total = 0;
+	while (r->head - r->tail < RX_RING_SIZE) {
+		unsigned int start = r->head & (RX_RING_SIZE - 1);
+		unsigned int space = RX_RING_SIZE - (r->head - r->tail);
+		if (start + space > RX_RING_SIZE) space = RX_RING_SIZE - start;	// only up to the wraparound point
+		int n = serialport_read_avail (fd, &r->data[start], space);
+		if (n < 0) return -1;
+		if (n == 0) break;
+		r->head += n;
+		total += n;
+		if ((unsigned int) n < space) break;	// drained the port
+	}
+	return total;
+}
+
+// run the parser over buffered bytes until it completes an event (stored in 'ev', returns
+// true) or runs out of input (returns false; the partial frame is remembered for next time).
+bool rx_next (rx_parser_t *p, ringbuf_t *r, rx_event_t *ev) {
+	while (r->tail != r->head) {
+		uchar inp = r->data[r->tail++ & (RX_RING_SIZE - 1)];
+		rx_event_t *e = &p->ev;
+
+		switch (p->state) {
+			case IDLE:
+				switch (inp) {
+					case 'a':
+						p->state = ACK;	break;
+					case 't':
+						p->state = RETRANSMIT;	break;
+					case 'r':
+						p->state = RESPONSE;	p->substate = 1;	break;
+					case 'A':
+						p->state = ABORT;
+						ev->type = RX_ABORT;
+						return true;
+					default:
+						ev->type = RX_JUNK;
+						ev->byte = inp;
+						return true;
+				}
+				break;
+			case ACK:
+				p->state = IDLE;
+				ev->type = RX_ACK;
+				ev->id = inp;
+				return true;
+			case RETRANSMIT:
+				p->state = IDLE;
+				if (inp == 'x') {
+					ev->type = RX_RETRANSMIT;
+				} else {
+					ev->type = RX_JUNK;
+					ev->byte = inp;
+				}
+				return true;
+			case RESPONSE:
+				/* Responses are structured as follows:
+				 * byte 0: 'r'
+				 * byte 1: ID number of the command to which this is a response
+				 * byte 2: number of bytes in the data for the response
+				 * [data]
+				 *
+				 * The 'substate' variable is used to keep track of where we are.
+				*/
+				if (p->substate == 1) {
+					e->id = inp;
+				} else if (p->substate == 2) {
+					e->len = inp;
+				} else {
+					e->data[p->substate - 3] = inp;
+				}
+				p->substate++;
+				if (p->substate >= 3 && p->substate - 3 == e->len) {	// we've received as many bytes as the router told us it wanted to send
+					p->state = IDLE;
+					p->substate = 0;
+					e->type = RX_RESPONSE;
+					memcpy (ev, e, offsetof (rx_event_t, data) + e->len);	// no need to copy the unused part of the data
+					return true;
+				}
+				break;
+			case ABORT:
+				// the only way to get out of the ABORT state is for the router to send a 'C' indicating things are clear
+				if (inp == 'C') {
+					p->state = IDLE;
+					ev->type = RX_CLEAR;
+					return true;
+				}
+				break;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,54 @@
+/* rxparse.h - buffering and parsing of the byte stream coming back from the router */
+#ifndef RXPARSE_H
+#define RXPARSE_H
+
+#include "command.h"
+
+#define RX_RING_SIZE 1024	// must be a power of 2
+
+// possible states of the parser
+#define IDLE 0
+#define ACK 1
+#define RESPONSE 2
+#define RETRANSMIT 3
+#define ABORT 4
+
+/* Received bytes are read off the serial port in bulk into a ring buffer, and then
+ * pulled out of it by the parser. head and tail just count up forever; they're masked
+ * when indexing. */
+typedef struct {
+	uchar data[RX_RING_SIZE];
+	unsigned int head;	// where the next byte read from the port goes
+	unsigned int tail;	// next byte for the parser
+} ringbuf_t;
+
+// what the router has told us
+typedef enum {
+	RX_ACK,			// command 'id' was received
+	RX_RETRANSMIT,	// 'tx': resend the command the router is waiting for
+	RX_RESPONSE,	// response to command 'id', 'len' bytes in 'data'
+	RX_ABORT,		// 'A': router has aborted, and is ignoring us until resume is pressed
+	RX_CLEAR,		// 'C': resume was pressed after an abort
+	RX_JUNK			// 'byte' doesn't fit the grammar
+} rx_evtype_t;
+
+typedef struct {
+	rx_evtype_t type;
+	uchar id;
+	uchar len;
+	uchar byte;
+	uchar data[256];
+} rx_event_t;
+
+/* The parser keeps all of its state here, so a frame can be split over any number of reads. */
+typedef struct {
+	int state;
+	int substate;
+	rx_event_t ev;	// event under construction
+} rx_parser_t;
+
+void rx_init (rx_parser_t *p, ringbuf_t *r);
+int rx_fill (ringbuf_t *r, int fd);
+bool rx_next (rx_parser_t *p, ringbuf_t *r, rx_event_t *ev);
+
+#endif
@@ -0,0 +1,133 @@
+/* schema.h - what every command looks like, in one table. The frame encoders, the G-code
+ * parser's operand handling, the response decoders and cmd_getstring are all generated from
+ * it (see command.cpp), so adding an opcode means adding its entry here and nothing else. */
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include "command.h"
+#include <cstddef>
+
+// types of operand
+#define ARG_NONE 0
+#define ARG_F32 1		// float (mm, degrees, ...), 4 bytes in the frame
+#define ARG_U8 2
+#define ARG_S8 3
+#define ARG_U16 4
+#define ARG_U32 5
+#define ARG_AXES 6		// written as letters ("xz"), sent as a byte with a bit per axis: .....ZYX
+#define ARG_STR 7		// the rest of the line, up to COM_STRLEN_MAX bytes; takes all four operand slots
+
+// what the firmware sends back in answer
+#define RESP_ECHO 0		// text (also what anything unexpected is shown as)
+#define RESP_POS 1		// three 2-byte coordinates, in 0.01 mm
+#define RESP_ENDSTOPS 2	// a byte with a bit per axis
+#define RESP_U32 3		// a 4-byte int
+#define RESP_SPINDLE 4	// the speed pot setting, as a 2-byte fraction of 1024 (in the second pair of bytes)
+
+typedef struct {
+	const char *name;		// as it's written in G-code
+	uchar op;
+	uchar arg[CMD_MAX_ARGS];	// operand types, in order; the frame has them packed big endian from COM_DATA_START
+	uchar resp;				// RESP_*
+	const char *label;		// what the response is shown as
+} cmdschema_t;
+
+static constexpr cmdschema_t cmd_schema[] = {
+	{"noop", NOOP, {}, RESP_ECHO, NULL},
+	{"mova", MOVA, {ARG_F32, ARG_F32, ARG_F32, ARG_F32}, RESP_ECHO, NULL},		// x y z feed
+	{"movr", MOVR, {ARG_F32, ARG_F32, ARG_F32, ARG_F32}, RESP_ECHO, NULL},		// dx dy dz feed
+	{"marc", MARC, {ARG_F32, ARG_F32, ARG_F32, ARG_F32}, RESP_ECHO, NULL},		// rad start_theta dtheta feed
+	{"mhlx", MHLX, {ARG_F32, ARG_F32, ARG_F32, ARG_F32}, RESP_ECHO, NULL},		// rad start_theta dtheta lead
+	{"home", HOME, {ARG_AXES}, RESP_ECHO, NULL},
+	{"clwo", CLWO, {}, RESP_ECHO, NULL},
+	{"swox", SWOX, {ARG_F32}, RESP_ECHO, NULL},
+	{"swoy", SWOY, {ARG_F32}, RESP_ECHO, NULL},
+	{"crot", CROT, {}, RESP_ECHO, NULL},
+	{"srot", SROT, {ARG_F32}, RESP_ECHO, NULL},
+	{"edgx", EDGX, {ARG_F32}, RESP_ECHO, NULL},		// max_travel
+	{"edgy", EDGY, {ARG_F32}, RESP_ECHO, NULL},
+	{"efmx", EFMX, {ARG_F32, ARG_F32, ARG_F32, ARG_S8}, RESP_ECHO, NULL},	// max_travel1 max_travel2 length zlift
+	{"efmy", EFMY, {ARG_F32, ARG_F32, ARG_F32, ARG_S8}, RESP_ECHO, NULL},
+	{"ef2x", EF2X, {ARG_F32, ARG_F32, ARG_F32, ARG_S8}, RESP_ECHO, NULL},	// max_travel backoff length zlift
+	{"ef2y", EF2Y, {ARG_F32, ARG_F32, ARG_F32, ARG_S8}, RESP_ECHO, NULL},
+	{"stpe", STPE, {}, RESP_ECHO, NULL},
+	{"stpd", STPD, {}, RESP_ECHO, NULL},
+	{"spne", SPNE, {}, RESP_ECHO, NULL},
+	{"spnd", SPND, {}, RESP_ECHO, NULL},
+	{"ssps", SSPS, {ARG_U16}, RESP_ECHO, NULL},		// rpm
+	{"wait", WAIT, {ARG_U16}, RESP_ECHO, NULL},		// ms
+	{"wusr", WUSR, {ARG_U8}, RESP_ECHO, NULL},		// message number
+	{"beep", BEEP, {ARG_U16, ARG_U16}, RESP_ECHO, NULL},	// hz ms
+	{"qpos", QPOS, {}, RESP_POS, NULL},
+	{"qabs", QABS, {}, RESP_ECHO, NULL},
+	{"qwor", QWOR, {}, RESP_ECHO, NULL},
+	{"qrot", QROT, {}, RESP_ECHO, NULL},
+	{"qend", QEND, {}, RESP_ENDSTOPS, "Endstops"},
+	{"qsps", QSPS, {}, RESP_SPINDLE, "Spindle speed"},
+	{"echo", ECHO, {ARG_STR}, RESP_ECHO, NULL},
+	{"sprv", SPRV, {ARG_U8}, RESP_ECHO, NULL},		// protocol version
+	{"qbdr", QBDR, {}, RESP_U32, "Fastest baud rate"},
+	{"sbdr", SBDR, {ARG_U32}, RESP_ECHO, NULL},		// baud
+	{"stop", STOP, {}, RESP_ECHO, NULL},
+};
+
+#define N_SCHEMA ((int) (sizeof(cmd_schema) / sizeof(cmd_schema[0])))
+
+static constexpr int arg_size (int type) {
+	return type == ARG_F32 || type == ARG_U32 ? 4 : type == ARG_U16 ? 2 : type == ARG_STR ? COM_STRLEN_MAX
+			: type == ARG_NONE ? 0 : 1;
+}
+
+static constexpr int schema_nargs (const cmdschema_t &s) {
+	int n = 0;
+	while (n < CMD_MAX_ARGS && s.arg[n] != ARG_NONE) n++;
+	return n;
+}
+
+// where operand i starts in the frame
+static constexpr int arg_offset (const cmdschema_t &s, int i) {
+	int off = COM_DATA_START;
+	for (int k=0; k < i; k++) off += arg_size (s.arg[k]);
+	return off;
+}
+
+// operand slots of an ircmd_t that are used (a string fills them all)
+static constexpr int schema_words (const cmdschema_t &s) {
+	return s.arg[0] == ARG_STR ? CMD_MAX_ARGS : schema_nargs (s);
+}
+
+// every entry has to fit in a frame, and appear only once
+static constexpr bool schema_ok () {
+	for (int k=0; k < N_SCHEMA; k++) {
+		if (arg_offset (cmd_schema[k], CMD_MAX_ARGS) > COM_SIZE - 1) return false;
+		for (int j=0; j < k; j++) {
+			if (cmd_schema[j].op == cmd_schema[k].op) return false;
+		}
+	}
+	return true;
+}
+static_assert (schema_ok (), "a command in cmd_schema doesn't fit in a frame, or is there twice");
+
+// opcode -> entry in cmd_schema (and its operand slots), worked out at compile time
+typedef struct {
+	signed char k[256];
+	uchar words[256];
+} schema_index_t;
+
+static constexpr schema_index_t make_schema_index () {
+	schema_index_t x = {};
+	for (int i=0; i < 256; i++) x.k[i] = -1;
+	for (int k=0; k < N_SCHEMA; k++) {
+		x.k[cmd_schema[k].op] = k;
+		x.words[cmd_schema[k].op] = schema_words (cmd_schema[k]);
+	}
+	return x;
+}
+static constexpr schema_index_t schema_index = make_schema_index ();
+
+// the schema for an opcode, or NULL if there's no such command
+static constexpr const cmdschema_t *cmd_schema_of (int op) {
+	return schema_index.k[op & 0xff] < 0 ? NULL : &cmd_schema[(int) schema_index.k[op & 0xff]];
+}
+
+#endif
@@ -14,6 +14,24 @@
 #include <string.h>   // String function definitions 
 #include <sys/ioctl.h>
 
+#ifdef __linux__
+// glibc's termios can't express arbitrary rates, but the kernel's termios2 can (with BOTHER).
+// The kernel header that defines it clashes with <termios.h>, so it's declared here instead.
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#endif
+
 // uncomment this to debug reads
 //#define SERIALPORTDEBUG 
 
@@ -42,23 +60,8 @@ int serialport_init(const char* serialport, int baud)
         perror("serialport_init: Couldn't get term attributes");
         return -1;
     }
-    speed_t brate = baud; // let you override switch below if needed
-    switch(baud) {
-    case 4800:   brate=B4800;   break;
-    case 9600:   brate=B9600;   break;
-#ifdef B14400
-    case 14400:  brate=B14400;  break;
-#endif
-    case 19200:  brate=B19200;  break;
-#ifdef B28800
-    case 28800:  brate=B28800;  break;
-#endif
-    case 38400:  brate=B38400;  break;
-    case 57600:  brate=B57600;  break;
-    case 115200: brate=B115200; break;
-    }
-    cfsetispeed(&toptions, brate);
-    cfsetospeed(&toptions, brate);
+    cfsetispeed(&toptions, B9600);	// the real rate is set by serialport_setbaud below
+    cfsetospeed(&toptions, B9600);
 
     // 8N1
     toptions.c_cflag &= ~PARENB;
@@ -72,6 +75,7 @@ int serialport_init(const char* serialport, int baud)
 
     toptions.c_cflag |= CREAD | CLOCAL;  // turn on READ & ignore ctrl lines
     toptions.c_iflag &= ~(IXON | IXOFF | IXANY); // turn off s/w flow ctrl
+    toptions.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL); // don't mangle CRs, NLs etc.
 
     toptions.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG); // make raw
     toptions.c_oflag &= ~OPOST; // make raw
@@ -86,10 +90,82 @@ int serialport_init(const char* serialport, int baud)
         perror("init_serialport: Couldn't set term attributes");
         return -1;
     }
+    if (serialport_setbaud(fd, baud) < 0) {
+        close(fd);
+        return -1;
+    }
 
     return fd;
 }
 
+// change the speed of an open port. On Linux any rate the UART can get close to is accepted;
+// elsewhere we're limited to the standard Bxxx rates. Returns 0, or -1 on error.
+int serialport_setbaud(int fd, int baud)
+{
+#ifdef __linux__
+    struct termios2 t2;
+    if (ioctl(fd, TCGETS2, &t2) < 0) {
+        perror("serialport_setbaud: TCGETS2");
+        return -1;
+    }
+    t2.c_cflag &= ~CBAUD;
+    t2.c_cflag |= BOTHER;
+    t2.c_ispeed = baud;
+    t2.c_ospeed = baud;
+    if (ioctl(fd, TCSETSW2, &t2) < 0) {
+        perror("serialport_setbaud: TCSETSW2");
+        return -1;
+    }
+    return 0;
+#else
+    struct termios toptions;
+    speed_t brate;
+    switch(baud) {
+    case 4800:   brate=B4800;   break;
+    case 9600:   brate=B9600;   break;
+#ifdef B14400
+    case 14400:  brate=B14400;  break;
+#endif
+    case 19200:  brate=B19200;  break;
+#ifdef B28800
+    case 28800:  brate=B28800;  break;
+#endif
+    case 38400:  brate=B38400;  break;
+    case 57600:  brate=B57600;  break;
+    case 115200: brate=B115200; break;
+#ifdef B230400
+    case 230400: brate=B230400; break;
+#endif
+#ifdef B460800
+    case 460800: brate=B460800; break;
+#endif
+#ifdef B500000
+    case 500000: brate=B500000; break;
+#endif
+#ifdef B921600
+    case 921600: brate=B921600; break;
+#endif
+#ifdef B1000000
+    case 1000000: brate=B1000000; break;
+#endif
+    default:
+        fprintf(stderr, "serialport_setbaud: %d baud isn't supported on this platform\n", baud);
+        return -1;
+    }
+    if (tcgetattr(fd, &toptions) < 0) {
+        perror("serialport_setbaud: Couldn't get term attributes");
+        return -1;
+    }
+    cfsetispeed(&toptions, brate);
+    cfsetospeed(&toptions, brate);
+    if (tcsetattr(fd, TCSADRAIN, &toptions) < 0) {
+        perror("serialport_setbaud: Couldn't set term attributes");
+        return -1;
+    }
+    return 0;
+#endif
+}
+
 int serialport_close( int fd )
 {
     return close( fd );
@@ -113,10 +189,30 @@ int serialport_write(int fd, void* data, int len)
     return 0;
 }
 
+// gather-write a batch of buffers. The port is non-blocking, so this can come up short;
+// returns the number of bytes actually written (0 if the port wasn't ready), or -1 on error.
+int serialport_writev(int fd, const struct iovec *iov, int cnt)
+{
+    int n = writev(fd, iov, cnt);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        perror("serialport_writev");
+    }
+    return n;
+}
+
 int serialport_read (int fd, char *b) {
 	return read (fd, b, 1);
 }
 
+// read whatever is waiting on the (non-blocking) port, up to max bytes. Returns the
+// number of bytes read, 0 if there was nothing there, or -1 on error.
+int serialport_read_avail (int fd, void *buf, int max) {
+	int n = read (fd, buf, max);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+	return n;
+}
+
 int serialport_read_until(int fd, char* buf, char until, int buf_max, int timeout)
 {
     char b[1];  // read expects an array, so we give it a 1-byte array
@@ -140,6 +236,12 @@ int serialport_read_until(int fd, char* buf, char until, int buf_max, int timeou
     return 0;
 }
 
+// throw away anything received but not yet read
+int serialport_discard_input(int fd)
+{
+    return tcflush(fd, TCIFLUSH);
+}
+
 int serialport_flush(int fd)
 {
     sleep(2); //required to make flush work, for some reason
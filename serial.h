@@ -7,15 +7,20 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 #include <stdint.h>
+#include <sys/uio.h>
 //#include <jni.h>
 //#include <JSerial.h>
 
 int serialport_init(const char* serialport, int baud);
 int serialport_close( int fd );
+int serialport_setbaud(int fd, int baud);
 int serialport_writebyte( int fd, uint8_t b);
 int serialport_write(int fd, void* str, int len);
+int serialport_writev(int fd, const struct iovec *iov, int cnt);
 int serialport_read (int fd, char *b);
+int serialport_read_avail (int fd, void *buf, int max);
 int serialport_read_until(int fd, char* buf, char until, int buf_max, int timeout);
 int serialport_flush(int fd);
+int serialport_discard_input(int fd);
 
 #endif
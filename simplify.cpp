@@ -0,0 +1,109 @@
+#include "simplify.h"
+#include <cmath>
+using namespace std;
+
+void simp_init (simplifier_t *s) {
+	s->run.clear ();
+	s->pt.clear ();
+	s->anchored = false;
+	s->dev = 0;
+	s->removed = 0;
+	s->max_dev = 0;
+	s->out.clear ();
+}
+
+// the merged move for what's in the run goes out
+static void flush (simplifier_t *s) {
+	int n = s->run.size ();
+	if (n == 0) return;
+	ircmd_t c = s->run[n-1];		// a MOVA run just goes straight to its last point
+	if (c.op == MOVR) {
+		c.a.f[0] = s->pt[2*n-2];
+		c.a.f[1] = s->pt[2*n-1];
+	}
+	s->out.push_back (c);
+	s->removed += n - 1;
+	if (s->dev > s->max_dev) s->max_dev = s->dev;
+	s->anchored = c.op == MOVA;
+	s->anchor = c;
+	s->run.clear ();
+	s->pt.clear ();
+	s->dev = 0;
+}
+
+// can c start a run?
+static bool can_start (simplifier_t *s, const ircmd_t *c) {
+	if (c->a.f[3] <= 0) return false;
+	if (c->op == MOVR) return c->a.f[2] == 0;
+	return c->op == MOVA && s->anchored && c->a.f[2] == s->anchor.a.f[2];
+}
+
+/* Would one move from the start of the run to (x, y) pass close enough to every point the run
+ * goes through now, in order? If so, how far off does it go (in *dev). */
+static bool fits (simplifier_t *s, double x, double y, double *dev) {
+	double len = sqrt (x*x + y*y), along = 0;
+	*dev = 0;
+	for (size_t i=0; i < s->pt.size(); i += 2) {
+		double px = s->pt[i], py = s->pt[i+1], d;
+		if (len < 1e-9) {
+			d = sqrt (px*px + py*py);
+		} else {
+			double t = (px * x + py * y) / len;
+			if (t < along - 1e-9) return false;	// it doubles back
+			along = t;
+			if (t < 0) {
+				d = sqrt (px*px + py*py);
+			} else if (t > len) {
+				d = sqrt ((px-x)*(px-x) + (py-y)*(py-y));
+			} else {
+				d = fabs (px * y - py * x) / len;
+			}
+		}
+		if (d > SIMPLIFY_TOLERANCE) return false;
+		if (d > *dev) *dev = d;
+	}
+	return true;
+}
+
+void simp_push (simplifier_t *s, const ircmd_t *c) {
+	if (!SIMPLIFY_PATHS) {
+		s->out.push_back (*c);
+		return;
+	}
+	if (!s->run.empty ()) {
+		const ircmd_t *first = &s->run[0];
+		size_t n = s->run.size ();
+		if (c->op == first->op && c->a.f[3] == first->a.f[3] && c->a.f[2] == (c->op == MOVR ? 0 : first->a.f[2])
+				&& n < SIMPLIFY_MAX_RUN) {
+			double x, y, dev;
+			if (c->op == MOVR) {
+				x = s->pt[2*n-2] + c->a.f[0];
+				y = s->pt[2*n-1] + c->a.f[1];
+			} else {
+				x = (double) c->a.f[0] - s->anchor.a.f[0];
+				y = (double) c->a.f[1] - s->anchor.a.f[1];
+			}
+			if (fits (s, x, y, &dev)) {
+				s->run.push_back (*c);
+				s->pt.push_back (x);
+				s->pt.push_back (y);
+				s->dev = dev;
+				return;
+			}
+		}
+		flush (s);
+	}
+	if (can_start (s, c)) {
+		s->run.push_back (*c);
+		s->pt.push_back (c->op == MOVR ? c->a.f[0] : (double) c->a.f[0] - s->anchor.a.f[0]);
+		s->pt.push_back (c->op == MOVR ? c->a.f[1] : (double) c->a.f[1] - s->anchor.a.f[1]);
+		return;
+	}
+	s->out.push_back (*c);
+	s->anchored = c->op == MOVA;	// anything else may move us, or move the origin
+	s->anchor = *c;
+}
+
+void simp_finish (simplifier_t *s) {
+	flush (s);
+}
@@ -0,0 +1,32 @@
+/* simplify.h - merges runs of short, nearly collinear moves (as CAM output is full of) into
+ * fewer, longer ones, never straying more than SIMPLIFY_TOLERANCE from the path as written.
+ * Every move costs a frame and a round trip however short it is. */
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "command.h"
+#include <vector>
+
+/* Moves go in one at a time, and come out (in 'out') when the run they're part of ends. A run
+ * is moves of one kind (all MOVA or all MOVR) at one feedrate that stay at one height; any
+ * other command, or a move that changes Z or the feedrate, ends it and goes out as it is. A
+ * run grows for as long as one straight move from its start to its latest point passes
+ * within the tolerance of every point in between (and meets them in order); then the merged
+ * move goes out, and a new run starts where it ended. That's the streaming equivalent of
+ * Douglas-Peucker: one pass, and at most SIMPLIFY_MAX_RUN points held. */
+typedef struct {
+	std::vector<ircmd_t> run;	// moves merged into the one being built
+	std::vector<double> pt;		// the point each of them ends at, x y pairs, relative to the start
+	ircmd_t anchor;			// (MOVA) where the run starts
+	bool anchored;			// anchor holds the last MOVA that went out
+	double dev;				// how far the move being built strays, so far
+	unsigned long removed;	// moves merged away so far
+	double max_dev;			// mm: the furthest a merged move has strayed from the original path
+	std::vector<ircmd_t> out;	// what's ready to go on (the caller empties it)
+} simplifier_t;
+
+void simp_init (simplifier_t *);
+void simp_push (simplifier_t *, const ircmd_t *);
+void simp_finish (simplifier_t *);
+
+#endif
@@ -0,0 +1,56 @@
+/* spsc.h - bounded lock-free queue for handing things from one thread to exactly one other */
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <atomic>
+
+/* A ring of N slots (N must be a power of 2). Only one thread may push and only one may pop.
+ * head and tail count up forever and are masked when indexing; each is written by just one
+ * side, and the release/acquire pairs make sure the item itself is visible before the index
+ * that publishes it. */
+template <typename T, unsigned int N>
+class Spscqueue {
+	public:
+		Spscqueue () : head(0), tail(0) {}
+
+		// producer side. Returns false if the queue is full.
+		bool push (const T &item) {
+			unsigned int h = head.load (std::memory_order_relaxed);
+			if (h - tail.load (std::memory_order_acquire) == N) return false;
+			items[h & (N-1)] = item;
+			head.store (h + 1, std::memory_order_release);
+			return true;
+		}
+
+		// producer side: how many more items would fit
+		unsigned int space () {
+			return N - (head.load (std::memory_order_relaxed) - tail.load (std::memory_order_acquire));
+		}
+
+		// consumer side. Returns false if the queue is empty.
+		bool pop (T *item) {
+			unsigned int t = tail.load (std::memory_order_relaxed);
+			if (t == head.load (std::memory_order_acquire)) return false;
+			*item = items[t & (N-1)];
+			tail.store (t + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer side: look at the next item without taking it
+		T *peek () {
+			unsigned int t = tail.load (std::memory_order_relaxed);
+			if (t == head.load (std::memory_order_acquire)) return NULL;
+			return &items[t & (N-1)];
+		}
+
+		bool empty () {
+			return head.load (std::memory_order_acquire) == tail.load (std::memory_order_acquire);
+		}
+
+	private:
+		T items[N];
+		std::atomic<unsigned int> head;	// written by the producer
+		std::atomic<unsigned int> tail;	// written by the consumer
+};
+
+#endif
@@ -0,0 +1,389 @@
+#include "travel.h"
+#include "workpool.h"
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+typedef struct {
+	double x, y;
+} pt2_t;
+
+// a stretch of the block that goes down from safe height and comes back up
+typedef struct {
+	int first, last;	// commands block[first..last]
+	pt2_t s, e;			// where it leaves safe height, and where it's back
+	pt2_t lo, hi;		// the box it cuts in (XY)
+	bool reversible;	// nothing but straight moves, so it can be cut backwards
+	int group;			// regions in the same group have to be cut in the order they're written
+	int prev;			// the one before it in its group (-1 if it's the first)
+} region_t;
+
+// a region in the order, maybe cut backwards
+typedef struct {
+	int r;
+	bool rev;
+} stop_t;
+
+// what the attempts at an order share
+typedef struct {
+	const vector<region_t> *reg;
+	pt2_t home, dest;	// where the order starts from, and where it has to end up
+	vector<vector<stop_t> > tour;	// each attempt's order
+	vector<long> effort;			// and the changes it has left to try
+	vector<double> cost;			// and its travel
+} search_t;
+
+static inline double dist (pt2_t a, pt2_t b) {
+	double dx = a.x - b.x, dy = a.y - b.y;
+	return sqrt (dx * dx + dy * dy);	// hypot takes care over overflow this doesn't need, and is a lot slower
+}
+
+static inline pt2_t entry (const search_t *s, stop_t t) {
+	const region_t *r = &(*s->reg)[t.r];
+	return t.rev ? r->e : r->s;
+}
+
+static inline pt2_t leave (const search_t *s, stop_t t) {
+	const region_t *r = &(*s->reg)[t.r];
+	return t.rev ? r->s : r->e;
+}
+
+static double tour_cost (const search_t *s, const vector<stop_t> &t) {
+	double c = 0;
+	pt2_t at = s->home;
+	for (size_t i=0; i < t.size(); i++) {
+		c += dist (at, entry (s, t[i]));
+		at = leave (s, t[i]);
+	}
+	return c + dist (at, s->dest);
+}
+
+// go to whichever region is closest next, except that attempt v starts at the v'th closest
+static void nearest_neighbour (const search_t *s, int v, vector<stop_t> *tour) {
+	const vector<region_t> &reg = *s->reg;
+	int n = reg.size ();
+	vector<bool> used (n, false);
+	pt2_t at = s->home;
+	tour->clear ();
+	for (int step=0; step < n; step++) {
+		vector<pair<double, stop_t> > best;
+		for (int i=0; i < n; i++) {
+			if (used[i] || (reg[i].prev >= 0 && !used[reg[i].prev])) continue;
+			for (int rev=0; rev < (OPT_REVERSE && reg[i].reversible ? 2 : 1); rev++) {
+				stop_t t = {i, rev != 0};
+				double d = dist (at, entry (s, t));
+				if (step == 0) {
+					best.push_back (make_pair (d, t));
+				} else if (best.empty () || d < best[0].first) {
+					best.assign (1, make_pair (d, t));
+				}
+			}
+		}
+		stop_t pick = best[0].second;
+		if (step == 0) {	// stable, so every attempt sees the same ranking
+			stable_sort (best.begin (), best.end (), [] (const pair<double, stop_t> &a, const pair<double, stop_t> &b) {
+				return a.first < b.first;
+			});
+			pick = best[min (v, (int) best.size () - 1)].second;
+		}
+		used[pick.r] = true;
+		tour->push_back (pick);
+		at = leave (s, pick);
+	}
+}
+
+// whether x is in the same group as any of t[i..i+len-1]
+static inline bool grouped (const search_t *s, stop_t x, const vector<stop_t> &t, int i, int len) {
+	int g = (*s->reg)[x.r].group;
+	for (int k=i; k < i + len; k++) {
+		if ((*s->reg)[t[k].r].group == g) return true;
+	}
+	return false;
+}
+
+/* Try moving each run of 1 to 3 regions to the best other place for it, as long as that
+ * doesn't take it past another region of its group. Returns whether anything moved. */
+static bool or_opt (const search_t *s, vector<stop_t> &t, long *effort) {
+	int n = t.size ();
+	bool improved = false;
+	for (int len=1; len <= 3; len++) {
+		for (int i=0; i + len <= n; i++) {
+			if (*effort <= 0) return improved;
+			*effort -= n;
+			pt2_t a = i > 0 ? leave (s, t[i-1]) : s->home;
+			pt2_t b = i + len < n ? entry (s, t[i+len]) : s->dest;
+			pt2_t cs = entry (s, t[i]), ce = leave (s, t[i+len-1]);
+			double gain = dist (a, cs) + dist (ce, b) - dist (a, b);
+			bool can_flip = len == 1 && OPT_REVERSE && (*s->reg)[t[i].r].reversible;
+			double best = -1e-9;
+			int bestj = -1;
+			bool flip = false;
+			int lo = i, hi = i + len;	// the gaps it can go to without passing one of its group
+			while (lo > 0 && !grouped (s, t[lo-1], t, i, len)) lo--;
+			while (hi < n && !grouped (s, t[hi], t, i, len)) hi++;
+			for (int j=lo; j <= hi; j++) {	// the gap before t[j]
+				bool here = j >= i && j <= i + len;
+				if (here && !can_flip) continue;
+				pt2_t p = here ? a : j > 0 ? leave (s, t[j-1]) : s->home;
+				pt2_t q = here ? b : j < n ? entry (s, t[j]) : s->dest;
+				double base = here ? dist (a, b) : dist (p, q);
+				if (!here) {
+					double d = dist (p, cs) + dist (ce, q) - base - gain;
+					if (d < best) {
+						best = d;
+						bestj = j;
+						flip = false;
+					}
+				}
+				if (can_flip) {
+					double d = dist (p, ce) + dist (cs, q) - base - gain;
+					if (d < best) {
+						best = d;
+						bestj = here ? i : j;
+						flip = true;
+					}
+				}
+			}
+			if (bestj < 0) continue;
+			vector<stop_t> run (t.begin () + i, t.begin () + i + len);
+			if (flip) run[0].rev = !run[0].rev;
+			t.erase (t.begin () + i, t.begin () + i + len);
+			int at = bestj > i ? bestj - len : bestj;
+			t.insert (t.begin () + at, run.begin (), run.end ());
+			improved = true;
+		}
+	}
+	return improved;
+}
+
+/* Cut a stretch of the order the other way round (each region in it backwards too), if that
+ * saves travel and there aren't two of a group in it. With straight line distances only the
+ * two ends of the stretch change. */
+static bool two_opt (const search_t *s, vector<stop_t> &t, long *effort) {
+	int n = t.size ();
+	bool improved = false;
+	vector<int> seen (s->reg->size (), -1);	// seen[g] == i: group g is in the stretch from i
+	for (int i=0; i < n; i++) {
+		if (*effort <= 0) return improved;
+		*effort -= n - i;
+		pt2_t a = i > 0 ? leave (s, t[i-1]) : s->home;
+		for (int j=i; j < n && (*s->reg)[t[j].r].reversible; j++) {
+			int g = (*s->reg)[t[j].r].group;
+			if (seen[g] == i) break;
+			seen[g] = i;
+			pt2_t b = j + 1 < n ? entry (s, t[j+1]) : s->dest;
+			double d = dist (a, leave (s, t[j])) + dist (entry (s, t[i]), b) - dist (a, entry (s, t[i])) - dist (leave (s, t[j]), b);
+			if (d < -1e-9) {
+				reverse (t.begin () + i, t.begin () + j + 1);
+				for (int k=i; k <= j; k++) t[k].rev = !t[k].rev;
+				improved = true;
+			}
+		}
+	}
+	return improved;
+}
+
+static void attempt (void *arg, int v) {
+	search_t *s = (search_t *) arg;
+	vector<stop_t> &t = s->tour[v];
+	long *effort = &s->effort[v];
+	nearest_neighbour (s, v, &t);
+	bool better = true;
+	while (better && *effort > 0) {
+		better = or_opt (s, t, effort);
+		if (OPT_REVERSE) better = two_opt (s, t, effort) || better;
+	}
+	s->cost[v] = tour_cost (s, t);
+}
+
+void travel_init (travel_t *t) {
+	pos_init (&t->pos);
+	t->feed = 0;
+	t->block.clear ();
+	t->regions = 0;
+	t->before = t->after = 0;
+	t->out.clear ();
+}
+
+static inline bool straight (int op) {
+	return op == MOVA || op == MOVR;
+}
+
+static int find (vector<int> &up, int i) {
+	while (up[i] != i) i = up[i] = up[up[i]];
+	return i;
+}
+
+/* Regions whose boxes overlap (or come within OPT_CLEARANCE of each other) may be cutting the
+ * same stock, like the passes of a step-down, so they're put in a group and kept in the order
+ * they're written. Overlapping is followed through: if A overlaps B and B overlaps C, all
+ * three are one group. The boxes are swept along X, so it's only slow if most of them do. */
+static void group_regions (vector<region_t> &reg) {
+	int n = reg.size ();
+	vector<int> up (n), by_x (n);
+	for (int i=0; i < n; i++) up[i] = by_x[i] = i;
+	sort (by_x.begin (), by_x.end (), [&reg] (int a, int b) {
+		return reg[a].lo.x < reg[b].lo.x;
+	});
+	for (int i=0; i < n; i++) {
+		const region_t *a = &reg[by_x[i]];
+		for (int j=i+1; j < n && reg[by_x[j]].lo.x <= a->hi.x + OPT_CLEARANCE; j++) {
+			const region_t *b = &reg[by_x[j]];
+			if (b->lo.y <= a->hi.y + OPT_CLEARANCE && a->lo.y <= b->hi.y + OPT_CLEARANCE) {
+				up[find (up, by_x[i])] = find (up, by_x[j]);
+			}
+		}
+	}
+	vector<int> last (n, -1);
+	for (int i=0; i < n; i++) {
+		reg[i].group = find (up, i);
+		reg[i].prev = last[reg[i].group];
+		last[reg[i].group] = i;
+	}
+}
+
+// stretch the box to take in (x, y)
+static inline void grow (region_t *r, double x, double y) {
+	r->lo.x = min (r->lo.x, x);	r->lo.y = min (r->lo.y, y);
+	r->hi.x = max (r->hi.x, x);	r->hi.y = max (r->hi.y, y);
+}
+
+// reorder the block into t->out; false if there's nothing to be gained (or it can't be done)
+static bool reorder (travel_t *t) {
+	const vector<ircmd_t> &b = t->block;
+	int n = b.size ();
+	if (!t->start.known[0] || !t->start.known[1] || !t->start.known[2]) return false;
+
+	// point k is where the machine is before command k (and point n, where it ends up)
+	vector<double> p (3 * (n + 1));
+	vector<float> feed (n + 1);		// and the feedrate then
+	postrack_t pos = t->start;
+	float f = t->start_feed;
+	for (int k=0; k <= n; k++) {
+		for (int i=0; i < 3; i++) p[3*k+i] = pos.w[i];
+		feed[k] = f;
+		if (k == n) break;
+		pos_track (&pos, &b[k]);
+		if (b[k].op != MHLX) f = b[k].a.f[3];
+	}
+	double zmax = -INFINITY, zmin = INFINITY;
+	for (int k=0; k <= n; k++) {
+		zmax = max (zmax, p[3*k+2]);
+		zmin = min (zmin, p[3*k+2]);
+	}
+	if (zmax - zmin < OPT_MIN_LIFT) return false;
+
+	// travel is straight moves at safe height; regions are what's between
+	vector<bool> travel (n);
+	int ft = -1, lt = -1;
+	for (int k=0; k < n; k++) {
+		travel[k] = straight (b[k].op) && p[3*k+2] >= zmax - 1e-6 && p[3*k+5] >= zmax - 1e-6;
+		if (travel[k]) {
+			if (ft < 0) ft = k;
+			lt = k;
+		}
+	}
+	if (ft < 0) return false;
+	vector<region_t> reg;
+	for (int k=ft; k <= lt; k++) {
+		if (travel[k]) continue;
+		region_t r = {k, k, {p[3*k], p[3*k+1]}, {0, 0}, {p[3*k], p[3*k+1]}, {p[3*k], p[3*k+1]}, true, 0, -1};
+		for (; !travel[k]; k++) {
+			r.last = k;
+			r.reversible = r.reversible && straight (b[k].op);
+			grow (&r, p[3*k+3], p[3*k+4]);
+			if (!straight (b[k].op)) {	// the whole circle, which is plenty
+				double rad = fabs (b[k].a.f[0]), th = b[k].a.f[1] * M_PI / 180;
+				double cx = p[3*k] - rad * cos (th), cy = p[3*k+1] - rad * sin (th);
+				grow (&r, cx - rad, cy - rad);
+				grow (&r, cx + rad, cy + rad);
+			}
+		}
+		r.e.x = p[3*r.last+3];
+		r.e.y = p[3*r.last+4];
+		reg.push_back (r);
+	}
+	if (reg.size () < 2 || reg.size () > OPT_MAX_REGIONS) return false;
+	group_regions (reg);
+
+	search_t s;
+	s.reg = &reg;
+	s.home.x = p[3*ft];
+	s.home.y = p[3*ft+1];
+	s.dest.x = p[3*lt+3];
+	s.dest.y = p[3*lt+4];
+	int tries = min (OPT_ATTEMPTS, (int) reg.size ());	// not one per thread: the answer can't depend on the machine
+	s.tour.resize (tries);
+	s.cost.resize (tries);
+	s.effort.assign (tries, OPT_EFFORT);
+	pool_run (tries, attempt, &s);
+	int v = min_element (s.cost.begin (), s.cost.end ()) - s.cost.begin ();
+	vector<stop_t> written (reg.size ());
+	for (size_t i=0; i < reg.size(); i++) {
+		written[i].r = i;
+		written[i].rev = false;
+	}
+	double was = tour_cost (&s, written);
+	if (s.cost[v] >= was - 1e-6) return false;
+
+	// the head up to the first travel, each region from a single move at safe height, then the tail
+	t->out.insert (t->out.end (), b.begin (), b.begin () + ft);
+	float tf = b[ft].a.f[3];
+	for (size_t i=0; i < s.tour[v].size(); i++) {
+		const region_t *r = &reg[s.tour[v][i].r];
+		bool rev = s.tour[v][i].rev;
+		const double *e = &p[3 * (rev ? r->last + 1 : r->first)];
+		ircmd_t go = {MOVA, b[r->first].line, {{(float) e[0], (float) e[1], (float) e[2], tf}}};
+		t->out.push_back (go);
+		if (!rev) {
+			if (b[r->first].op == MHLX && feed[r->first] != tf) {	// it goes at the feedrate it had before
+				ircmd_t set = {MOVR, b[r->first].line, {{0, 0, 0, feed[r->first]}}};
+				t->out.push_back (set);
+			}
+			t->out.insert (t->out.end (), b.begin () + r->first, b.begin () + r->last + 1);
+		} else {
+			for (int k = r->last; k >= r->first; k--) {
+				ircmd_t m = {MOVA, b[k].line, {{(float) p[3*k], (float) p[3*k+1], (float) p[3*k+2], b[k].a.f[3]}}};
+				t->out.push_back (m);
+			}
+		}
+	}
+	const double *e = &p[3 * (lt + 1)];
+	ircmd_t go = {MOVA, b[lt].line, {{(float) e[0], (float) e[1], (float) e[2], b[lt].a.f[3]}}};
+	t->out.push_back (go);
+	t->out.insert (t->out.end (), b.begin () + lt + 1, b.end ());
+	t->regions += reg.size ();
+	t->before += was;
+	t->after += s.cost[v];
+	return true;
+}
+
+static void flush (travel_t *t) {
+	if (t->block.empty ()) return;
+	if (!reorder (t)) t->out.insert (t->out.end (), t->block.begin (), t->block.end ());
+	t->block.clear ();
+}
+
+void travel_push (travel_t *t, const ircmd_t *c) {
+	if (!OPT_TRAVEL) {
+		t->out.push_back (*c);
+		return;
+	}
+	if (c->op == MOVA || c->op == MOVR || c->op == MARC || c->op == MHLX) {
+		if (t->block.empty ()) {
+			t->start = t->pos;
+			t->start_feed = t->feed;
+		}
+		t->block.push_back (*c);
+		if (t->block.size () >= OPT_MAX_BLOCK) flush (t);
+	} else {
+		flush (t);
+		t->out.push_back (*c);
+	}
+	pos_track (&t->pos, c);
+	if (c->op == MOVA || c->op == MOVR || c->op == MARC) t->feed = c->a.f[3];
+}
+
+void travel_finish (travel_t *t) {
+	flush (t);
+}
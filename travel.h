@@ -0,0 +1,41 @@
+/* travel.h - reorders the separate cuts in a job to cut down the travel between them. Jobs
+ * put together from several CAM programs tend to go back and forth across the table. */
+#ifndef TRAVEL_H
+#define TRAVEL_H
+
+#include "planner.h"
+#include <vector>
+
+/* Moves are held until something that isn't a move (a wait, a WUSR for a tool change, the
+ * spindle, ...), which stays just where it is: only what's between two of those is
+ * reordered. In there, the highest Z the moves go to is taken as the safe height, and each
+ * stretch that goes down from it and comes back up is a region. The straight moves at safe
+ * height between regions are the travel; they're thrown away, and after the regions have been
+ * put in a better order, a single MOVA at safe height takes the machine to each in turn (and
+ * to where the original travel ended up, after the last). Regions that overlap in XY are
+ * never put in a different order from each other: the second might be cutting deeper into
+ * what the first leaves behind.
+ *
+ * The order starts off nearest-neighbour, and is then improved by Or-opt (moving a run of up
+ * to three regions elsewhere) and, if regions may be cut backwards (OPT_REVERSE), 2-opt. There
+ * are OPT_ATTEMPTS attempts, spread over the work pool, each starting from a different first
+ * region; the best one wins, and only if it beats the order as written. The search stops when
+ * nothing helps or after OPT_EFFORT changes tried, and never on a clock, so a job always comes
+ * out the same however busy the machine is or whatever else is using the pool (the streaming
+ * loader and the job cache can be at it together, and have to agree). */
+typedef struct {
+	postrack_t pos;			// where the commands so far have taken the machine
+	float feed;				// the last feedrate
+	std::vector<ircmd_t> block;	// moves since the last barrier
+	postrack_t start;		// where they start
+	float start_feed;
+	unsigned long regions;	// regions that were reordered
+	double before, after;	// mm of travel between them, as written and as reordered
+	std::vector<ircmd_t> out;	// what's ready to go on (the caller empties it)
+} travel_t;
+
+void travel_init (travel_t *);
+void travel_push (travel_t *, const ircmd_t *);
+void travel_finish (travel_t *);
+
+#endif
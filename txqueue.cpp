@@ -0,0 +1,67 @@
+#include "txqueue.h"
+#include "serial.h"
+#include <cstring>
+#include <sys/uio.h>
+
+void txq_init (txqueue_t *q) {
+	q->head = q->tail = 0;
+	q->off = 0;
+	q->bytes = 0;
+}
+
+// add a frame to the queue. Returns false if the queue is full.
+bool txq_push (txqueue_t *q, const void *bytes, int len) {
+	if (q->head - q->tail == TXQ_FRAMES || len > TXQ_MAX_FRAME) return false;
+	txframe_t *f = &q->frames[q->head++ & (TXQ_FRAMES - 1)];
+	memcpy (f->bytes, bytes, len);
+	f->len = len;
+	q->bytes += len;
+	return true;
+}
+
+// throw away every frame that hasn't started going out yet. A partially written frame is
+// kept, since the other end is already part way through receiving it.
+void txq_discard (txqueue_t *q) {
+	if (txq_empty (q)) return;
+	if (q->off == 0) {
+		q->head = q->tail;
+		q->bytes = 0;
+	} else {
+		txframe_t *f = &q->frames[q->tail & (TXQ_FRAMES - 1)];
+		q->head = q->tail + 1;
+		q->bytes = f->len - q->off;
+	}
+}
+
+// write as much of the queue as the port will take in one writev. Returns the number of
+// bytes written (0 if the port wasn't ready for more), or -1 on error.
+int txq_flush (txqueue_t *q, int fd) {
+	struct iovec iov[TXQ_IOV];
+	int cnt = 0;
+	for (unsigned int i = q->tail; i != q->head && cnt < TXQ_IOV; i++, cnt++) {
+		txframe_t *f = &q->frames[i & (TXQ_FRAMES - 1)];
+		int skip = (i == q->tail) ? q->off : 0;
+		iov[cnt].iov_base = f->bytes + skip;
+		iov[cnt].iov_len = f->len - skip;
+	}
+	if (cnt == 0) return 0;
+
+	int n = serialport_writev (fd, iov, cnt);
+	if (n <= 0) return n;
+
+	// retire the frames that made it out completely
+	q->bytes -= n;
+	int left = n;
+	while (left > 0) {
+		txframe_t *f = &q->frames[q->tail & (TXQ_FRAMES - 1)];
+		int rem = f->len - q->off;
+		if (left < rem) {
+			q->off += left;
+			break;
+		}
+		left -= rem;
+		q->off = 0;
+		q->tail++;
+	}
+	return n;
+}
@@ -0,0 +1,38 @@
+/* txqueue.h - queue of outgoing frames, written to the serial port in batches */
+#ifndef TXQUEUE_H
+#define TXQUEUE_H
+
+#include "command.h"
+#include "compact.h"
+
+#define TXQ_FRAMES 256		// must be a power of 2
+#define TXQ_MAX_FRAME COMPACT_MAX_FRAME	// largest frame we'll be asked to queue (COM_SIZE or a v3 frame)
+#define TXQ_IOV 64			// most frames handed to a single writev
+
+typedef struct {
+	uchar bytes[TXQ_MAX_FRAME];
+	uchar len;
+} txframe_t;
+
+/* Frames are copied in by txq_push and written out by txq_flush, which gathers as many of
+ * them as it can into one writev. If a write comes up short, 'off' remembers how much of
+ * the frame at the tail already went out. head and tail count up forever; they're masked
+ * when indexing. */
+typedef struct {
+	txframe_t frames[TXQ_FRAMES];
+	unsigned int head;	// where the next frame goes
+	unsigned int tail;	// oldest frame not completely written
+	int off;			// bytes of the tail frame already written
+	int bytes;			// total bytes waiting to go out
+} txqueue_t;
+
+void txq_init (txqueue_t *q);
+bool txq_push (txqueue_t *q, const void *bytes, int len);
+void txq_discard (txqueue_t *q);
+int txq_flush (txqueue_t *q, int fd);
+
+static inline bool txq_empty (txqueue_t *q) {
+	return q->head == q->tail;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include "workpool.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+using namespace std;
+
+static pthread_mutex_t run_mut = PTHREAD_MUTEX_INITIALIZER;	// one batch at a time
+static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static int nworkers = 0;
+static unsigned int batch = 0;		// bumped for every batch, so workers know there's a new one
+static void (*task) (void *, int);
+static void *task_arg;
+static int task_n;
+static atomic<int> next_item;
+static int busy;					// workers still on the current batch (under mut)
+
+// take items until there are none left
+static void work () {
+	int i;
+	while ((i = next_item.fetch_add (1)) < task_n) {
+		task (task_arg, i);
+	}
+}
+
+static void *worker (void *arg) {
+	unsigned int seen = 0;
+	while (true) {
+		pthread_mutex_lock (&mut);
+		while (batch == seen) pthread_cond_wait (&start_cond, &mut);
+		seen = batch;
+		pthread_mutex_unlock (&mut);
+
+		work ();
+
+		pthread_mutex_lock (&mut);
+		if (--busy == 0) pthread_cond_signal (&done_cond);
+		pthread_mutex_unlock (&mut);
+	}
+	return NULL;
+}
+
+static void start_pool () {
+	long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+	nworkers = ncpu > 1 ? (ncpu < POOL_MAX_THREADS ? ncpu : POOL_MAX_THREADS) - 1 : 0;	// the caller makes up the last one
+	for (int i=0; i < nworkers; i++) {
+		pthread_t t;
+		pthread_create (&t, NULL, worker, NULL);
+		pthread_detach (t);
+	}
+}
+
+int pool_threads () {
+	pthread_once (&once, start_pool);
+	return nworkers + 1;
+}
+
+void pool_run (int n, void (*fn) (void *arg, int i), void *arg) {
+	pthread_once (&once, start_pool);
+	if (n <= 1 || nworkers == 0) {	// not worth waking anybody up
+		for (int i=0; i < n; i++) fn (arg, i);
+		return;
+	}
+	pthread_mutex_lock (&run_mut);
+	pthread_mutex_lock (&mut);
+	task = fn;
+	task_arg = arg;
+	task_n = n;
+	next_item = 0;
+	busy = nworkers;
+	batch++;
+	pthread_cond_broadcast (&start_cond);
+	pthread_mutex_unlock (&mut);
+
+	work ();
+
+	pthread_mutex_lock (&mut);
+	while (busy > 0) pthread_cond_wait (&done_cond, &mut);
+	pthread_mutex_unlock (&mut);
+	pthread_mutex_unlock (&run_mut);
+}
@@ -0,0 +1,14 @@
+/* workpool.h - a fixed set of worker threads for spreading big jobs (like parsing) over all the cores */
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#define POOL_MAX_THREADS 64
+
+/* Call fn (arg, i) for every i from 0 to n-1, spread over the pool's threads and the calling
+ * thread, and return once they've all finished. Items are handed out one at a time, so they
+ * don't need to be the same size. Only one batch runs at once; a second caller waits its turn. */
+void pool_run (int n, void (*fn) (void *arg, int i), void *arg);
+
+int pool_threads ();	// how many threads (counting the caller) pool_run uses
+
+#endif